@@ -25,134 +25,182 @@ SOFTWARE.
 #define __7seg_hpp__
 
 #include <avr/io.h>
+#include "flash.hpp"
 
 #ifndef COUNTOF
 #define COUNTOF(x) (int)(sizeof(x)/sizeof(x[0]))
 #endif
 
-struct _font
+// generated by font.py, segment bits for characters ' ' to 'Z'
+static const uint8_t glyphs[] PROGMEM =
 {
-  char c;
-  uint8_t bits;
+  0x00, // ' '
+  0x00, // '!'
+  0x00, // '"'
+  0x00, // '#'
+  0x00, // '$'
+  0x00, // '%'
+  0x00, // '&'
+  0x00, // '''
+  0x00, // '('
+  0x00, // ')'
+  0x00, // '*'
+  0x00, // '+'
+  0x00, // ','
+  0x40, // '-'
+  0x00, // '.'
+  0x00, // '/'
+  0x3f, // '0'
+  0x06, // '1'
+  0x5b, // '2'
+  0x4f, // '3'
+  0x66, // '4'
+  0x6d, // '5'
+  0x7d, // '6'
+  0x07, // '7'
+  0x7f, // '8'
+  0x6f, // '9'
+  0x00, // ':'
+  0x00, // ';'
+  0x00, // '<'
+  0x00, // '='
+  0x00, // '>'
+  0x00, // '?'
+  0x00, // '@'
+  0x77, // 'A'
+  0x7c, // 'B'
+  0x39, // 'C'
+  0x5e, // 'D'
+  0x79, // 'E'
+  0x71, // 'F'
+  0x3d, // 'G'
+  0x74, // 'H'
+  0x04, // 'I'
+  0x04, // 'J'
+  0x76, // 'K'
+  0x38, // 'L'
+  0x37, // 'M'
+  0x54, // 'N'
+  0x5c, // 'O'
+  0x73, // 'P'
+  0x5c, // 'Q'
+  0x50, // 'R'
+  0x6d, // 'S'
+  0x78, // 'T'
+  0x1c, // 'U'
+  0x1c, // 'V'
+  0x3e, // 'W'
+  0x76, // 'X'
+  0x6e, // 'Y'
+  0x5b, // 'Z'
 };
 
-// this character to bit pattern map gets simply linear searched
-// performance is not that important, so optimizing for size instead
-static struct _font font[] =
-{
-  { ' ',  0x00 },
-  { '-',  0x40 },
-  { '0',  0x3f },
-  { '1',  0x06 },
-  { '2',  0x5b },
-  { '3',  0x4f },
-  { '4',  0x66 },
-  { '5',  0x6d },
-  { '6',  0x7d },
-  { '7',  0x07 },
-  { '8',  0x7f },
-  { '9',  0x6f },
-  { 'A',  0x77 },
-  { 'C',  0x39 },
-  { 'E',  0x79 },
-  { 'F',  0x71 },
-  { 'G',  0x3d },
-  { 'K',  0x76 },
-  { 'L',  0x38 },
-  { 'M',  0x37 },
-  { 'P',  0x73 },
-  { 'S',  0x6d },
-  { 'W',  0x3e },
-  { 'X',  0x76 },
-  { 'B',  0x7c },
-  { 'C',  0x58 },
-  { 'D',  0x5e },
-  { 'H',  0x74 },
-  { 'I',  0x04 },
-  { 'J',  0x04 },
-  { 'N',  0x54 },
-  { 'O',  0x5c },
-  { 'Q',  0x5c },
-  { 'R',  0x50 },
-  { 'T',  0x78 },
-  { 'U',  0x1c },
-  { 'V',  0x1c },
-  { 'Y',  0x6e },
-  { 'Z',  0x5b }
-};
+// brightness is the number of lit multiplex slots out of DISPLAY_LEVELS,
+// the digits are only scanned on lit slots. after DISPLAY_IDLE refresh
+// calls without Wake() the display drops to DISPLAY_DIM
+#define DISPLAY_LEVELS 4
+#ifndef DISPLAY_DIM
+#define DISPLAY_DIM 2
+#endif
+#ifndef DISPLAY_IDLE
+#define DISPLAY_IDLE 1200 // about 3 seconds at 2.56ms per refresh
+#endif
+
+// cathode pattern per digit position, the selected digit pulled low.
+// the last digit is on PB3, or on PB7 when PB3 drives a second servo.
+// DISPLAY_KEEP are the other port B bits that a refresh leaves alone
+#if defined(HOPPERS) && HOPPERS>1
+#define DISPLAY_CATHODES 0xb0
+#define DISPLAY_KEEP 0x0a
+static const uint8_t cathodes[3] PROGMEM = { 0x90, 0xa0, 0x30 };
+#else
+#define DISPLAY_CATHODES 0xb8
+#define DISPLAY_KEEP 0x82
+static const uint8_t cathodes[3] PROGMEM = { 0x18, 0x28, 0x30 };
+#endif
 
 class Display
 {
-  uint8_t chars[3];
+  // ready to write port images, segments and cathodes
+  uint8_t portb[3],portd[3];
   uint8_t idx,dp;
   uint8_t off;
+  uint8_t level,slots,lit;
+  uint16_t idle;
+  uint16_t shown; // last value from printd/printx
+  uint8_t format; // 'd' or 'x' when shown is valid
     
+  void put(uint8_t i,uint8_t bits)
+  {
+    portb[i]=((bits>>5)&1) | ((bits>>4)&4) | flash_read(&cathodes[i]);
+    portd[i]=((bits<<1)&6) | ((bits<<3)&0xe0);
+    format=0;
+  }
+
 public:
   Display()
   {
-    chars[0]=0;
-    chars[1]=0;
-    chars[2]=0;
-    idx=0;
-    dp=0;
-    off=0;
+    level=DISPLAY_LEVELS;
+    slots=0;
+    lit=0;
+    Clear();
   }
   
-  void On() { off=0; }
-  void Off() { off=1; PORTB|=0xb8; }
+  void On() { off=0; Wake(); }
+  void Off() { off=1; lit=0; PORTB|=DISPLAY_CATHODES; }
+
+  // full brightness again, called on user activity
+  void Wake() { idle=0; }
+
+  // brightness 1..DISPLAY_LEVELS
+  void Brightness(uint8_t l) { level=l; }
+
+  // true if a digit was lit by the last refresh
+  uint8_t Lit() { return lit; }
 
   void Clear() { 
-    chars[0]=0x00; chars[1]=0x00; chars[2]=0x00;
+    put(0,0); put(1,0); put(2,0);
     idx=0; dp=0; off=0;
   }
     
   void refresh(void)
   {
-    PORTB|=0xb8; // all digits off
+    uint8_t l=level;
+    PORTB|=DISPLAY_CATHODES; // all digits off
+    lit=0;
     if (off)
       return;
-    uint8_t bits=chars[dp];
-    PORTB&=0xba; // all segments
-    PORTD&=0x19; // off too
-    PORTB|=(((bits>>5)&1) | ((bits>>4)&4));
-    PORTD|=((bits<<1)&6) | ((bits<<3)&0xe0);
-    switch (dp) {
-      case 0:
-        PORTB&=0x9f;
-        break;
-      case 1:
-        PORTB&=0xaf;
-        break;
-      case 2:
-        PORTB&=0xb7;
-        break;
-    }
+    if (idle<DISPLAY_IDLE)
+      idle++;
+    else if (l>DISPLAY_DIM)
+      l=DISPLAY_DIM;
+    // spread the blank slots evenly
+    slots+=l;
+    if (slots<DISPLAY_LEVELS)
+      return;
+    slots-=DISPLAY_LEVELS;
+    lit=(portb[dp]&0x05)|portd[dp];
+    PORTD=(PORTD&0x19)|portd[dp];
+    PORTB=(PORTB&DISPLAY_KEEP)|portb[dp]; // segments and digit at once
     dp=(dp+1)%3;
   }
   
   void putc(uint8_t c)
   {
-    uint8_t i;
     switch (c)
     {
       case '\r':
         idx=0;
         return;
       case '\n':
-        chars[0]=0;
-        chars[1]=0;
-        chars[2]=0;
+        put(0,0); put(1,0); put(2,0);
         idx=0;
         return;
       default:
-        for (i=0;i<COUNTOF(font);i++) {
-          if (font[i].c==c) {
-            chars[idx++]=font[i].bits;
-            idx%=3;
-            return;
-          }
-        }
-        chars[idx++]=0;
+        if (c>=' ' && c<=' '+COUNTOF(glyphs)-1)
+          put(idx++,flash_read(&glyphs[c-' ']));
+        else
+          put(idx++,0);
         idx%=3;
         return;
     }
@@ -163,6 +211,14 @@ public:
     while (s && *s)
       putc(*s++);
   }  
+
+  // string in flash
+  void puts_P(const char *s)
+  {
+    uint8_t c;
+    while ((c=flash_read(s++)))
+      putc(c);
+  }
   
   void putx(uint8_t c)
   {
@@ -172,20 +228,31 @@ public:
     putc(c);
   }
 
+  // redraws are skipped when the same value is already shown
   void printx(uint16_t v)
   {
+    if (format=='x' && shown==v) {
+      idx=0;
+      return;
+    }
     idx=0;
     putx(v>>8);
     putx(v>>4);
     putx(v);
+    shown=v;
+    format='x';
   }
   
   void printd(uint16_t v)
   {  
     putc('\r');
+    if (format=='d' && shown==v)
+      return;
     putc((v%1000)/100+'0');
     putc((v%100)/10+'0');
     putc((v%10)+'0');
+    shown=v;
+    format='d';
   }
   
 };
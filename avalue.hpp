@@ -26,16 +26,37 @@ SOFTWARE.
 
 #include <avr/io.h>
 
-// this is a very simple analog value accumulator
-// the internal value is updated every 64 updates with
-// an average value of these 64
-class Avalue
+// analog value filters, picked at compile time so that the update
+// in an interrupt handler is only the code of one filter. SHIFT
+// gives the number of samples as a power of two, SAMPLES is how
+// many updates it takes to get a value from scratch
+//
+// AVALUE_BLOCK   average of a block of samples, the value changes
+//                once per block
+// AVALUE_EMA     exponential moving average, the value follows each
+//                sample with weight 1/2^SHIFT
+// AVALUE_TRIM    block average with the lowest and the highest
+//                sample of the block left out, a short dip or spike
+//                does not get into the value
+enum { AVALUE_BLOCK, AVALUE_EMA, AVALUE_TRIM };
+
+// accumulator wide enough for 2^SHIFT 10 bit samples
+template<bool WIDE> struct AvalueSum { typedef uint16_t type; };
+template<> struct AvalueSum<true> { typedef uint32_t type; };
+
+template<uint8_t SHIFT,uint8_t FILTER=AVALUE_BLOCK> class Avalue;
+
+template<uint8_t SHIFT> class Avalue<SHIFT,AVALUE_BLOCK>
 {
-  uint16_t v,av,c;
+  typedef typename AvalueSum<(SHIFT>6)>::type sum_t;
+  sum_t av;
+  uint16_t v,c;
 public:
+  enum { SAMPLES=1<<SHIFT };
+
   Avalue()
   {
-    v=0; av=0; c=0;
+    Clear();
   }
   
   void Clear(void)
@@ -47,10 +68,88 @@ public:
   {
     av+=a;
     c++;
-    if (c==64) {
-      v=av/64;
+    if (c==SAMPLES) {
+      v=av>>SHIFT;
+      c=0;
+      av=0;
+    }
+  }
+  
+  uint16_t Get(void)
+  {
+    return v;
+  }
+
+};
+
+template<uint8_t SHIFT> class Avalue<SHIFT,AVALUE_EMA>
+{
+  typedef typename AvalueSum<(SHIFT>6)>::type sum_t;
+  sum_t av; // the value in 1/2^SHIFT units
+  uint8_t started;
+public:
+  enum { SAMPLES=1 };
+
+  Avalue()
+  {
+    Clear();
+  }
+  
+  void Clear(void)
+  {
+    av=0; started=0;
+  }
+  
+  // the first sample is taken as it is
+  void Update(uint16_t a)
+  {
+    if (!started) {
+      av=(sum_t)a<<SHIFT;
+      started=1;
+    }
+    else
+      av=av-(av>>SHIFT)+a;
+  }
+  
+  uint16_t Get(void)
+  {
+    return av>>SHIFT;
+  }
+
+};
+
+template<uint8_t SHIFT> class Avalue<SHIFT,AVALUE_TRIM>
+{
+  typedef typename AvalueSum<(SHIFT>5)>::type sum_t;
+  sum_t av;
+  uint16_t v,c,lo,hi;
+public:
+  enum { SAMPLES=(1<<SHIFT)+2 };
+
+  Avalue()
+  {
+    Clear();
+  }
+  
+  void Clear(void)
+  {
+    v=0; av=0; c=0; lo=0xffff; hi=0;
+  }
+  
+  void Update(uint16_t a)
+  {
+    av+=a;
+    if (a<lo)
+      lo=a;
+    if (a>hi)
+      hi=a;
+    c++;
+    if (c==SAMPLES) {
+      v=(av-lo-hi)>>SHIFT;
       c=0;
       av=0;
+      lo=0xffff;
+      hi=0;
     }
   }
   
@@ -0,0 +1,113 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include "bench.h"
+
+// firmware harness for simbench, build for the target and run in simavr
+//
+// the firmware is compiled into this file with its main renamed, so that
+// the code measured is exactly what goes into the device
+
+// the DS1302 primitives are private to Clock
+#define class struct
+#include "../clock.hpp"
+#undef class
+#define main firmware_main
+#include "../catfeeder.cpp"
+#undef main
+
+#define RUNS 16
+#define TICKS 64
+
+#define MEASURE(id,code) do { \
+    GPIOR0=BENCH_##id; \
+    asm volatile("" ::: "memory"); \
+    code; \
+    asm volatile("" ::: "memory"); \
+    GPIOR0=BENCH_NONE; \
+  } while (0)
+
+volatile uint16_t sink;
+
+// let the timer interrupt run in place for a while
+static void interrupts(uint8_t id)
+{
+uint8_t i;
+  GPIOR0=id;
+  sei();
+  for (i=0;i<TICKS;i++)
+    sleep_cpu();
+  cli();
+  GPIOR0=BENCH_NONE;
+}
+
+int main(void)
+{
+uint8_t i,Y,M,D,h,m,s,w,servings[HOPPERS];
+  // same I/O setup as the firmware
+  DDRC=0x38;
+  DDRD=0xfe;
+  DDRB=0xbf;
+  PORTC=0x06;
+  PORTD=0x01;
+  PORTB=0x00;
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  TCCR0B=4;
+  DIDR0=1;
+  ADMUX=0xc0;
+  ADCSRA=0;
+  PRR|=_BV(PRADC);
+  battery_calibrate();
+  eeprom_read_block(&feeding_schedule,&ee_feeding_schedule,sizeof(feeding_schedule));
+  schedule_sort();
+  fullpower();
+  display.puts("BAT");
+  for (i=0;i<RUNS;i++) {
+    MEASURE(EMPTY,);
+    MEASURE(REFRESH,display.refresh());
+    MEASURE(CLOCK_READ,sink=clock.read(0x81));
+    MEASURE(CLOCK_WRITE,clock.write(0x8e,0x80));
+    MEASURE(READDATETIME,clock.ReadDateTime(Y,M,D,h,m,s,w));
+    MEASURE(FEEDING_TIME,sink=feeding_time(servings));
+    MEASURE(BATTERY,sink=battery_voltage(512)); // the conversion runs in sleep
+  }
+  for (i=0;i<4;i++) {
+    player.Play(melody_elise);
+    MEASURE(RTTTL_UPDATE,sink=player.Update()); // starts a note
+  }
+  player.Play(0);
+  TIMSK0=1;
+  fullpower();
+  interrupts(BENCH_TIMER0_FULL);
+  lowpower();
+  interrupts(BENCH_TIMER0_LOW);
+  GPIOR0=BENCH_DONE;
+  cli();
+  sleep_cpu();
+  return 0;
+}
@@ -0,0 +1,61 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __bench_h__
+#define __bench_h__
+
+// benchmark identifiers shared by the firmware harness and simbench
+//
+// the harness writes the identifier of a benchmark to GPIOR0 right
+// before the measured code and BENCH_NONE right after it. simbench
+// counts the cycles in between. timer0 interrupts are measured in place
+// from the vector to reti while GPIOR0 holds one of the TIMER0 ids
+
+#define BENCH_GPIOR0 0x3e       // GPIOR0 in data address space
+#define BENCH_TIMER0_VECTOR 16  // TIMER0_OVF_vect on ATmega168
+#define BENCH_VECTOR_SIZE 4     // jmp instruction per vector
+
+#define BENCHMARKS \
+  BENCH(EMPTY,         "empty") \
+  BENCH(TIMER0_FULL,   "TIMER0_OVF_vect/FULL") \
+  BENCH(TIMER0_LOW,    "TIMER0_OVF_vect/LOW") \
+  BENCH(REFRESH,       "Display::refresh") \
+  BENCH(CLOCK_READ,    "Clock::read") \
+  BENCH(CLOCK_WRITE,   "Clock::write") \
+  BENCH(READDATETIME,  "Clock::ReadDateTime") \
+  BENCH(RTTTL_UPDATE,  "RTTTL::Update") \
+  BENCH(FEEDING_TIME,  "feeding_time") \
+  BENCH(BATTERY,       "battery_voltage")
+
+enum {
+  BENCH_NONE,
+#define BENCH(id,name) BENCH_##id,
+  BENCHMARKS
+#undef BENCH
+  BENCH_COUNT,
+  BENCH_DONE=0xff
+};
+
+#define BENCH_IS_INTERRUPT(id) ((id)==BENCH_TIMER0_FULL || (id)==BENCH_TIMER0_LOW)
+
+#endif
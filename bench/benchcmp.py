@@ -0,0 +1,53 @@
+# MIT License
+#
+# Copyright (c) 2017 Madis Kaal
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# compares two simbench outputs and prints the change in average cycles
+#
+# usage: benchcmp.py old.json new.json
+
+import json
+import sys
+
+def load(fn):
+  r = {}
+  for line in open(fn):
+    line = line.strip()
+    if line:
+      b = json.loads(line)
+      r[b["name"]] = b
+  return r
+
+if len(sys.argv) != 3:
+  sys.stderr.write("usage: %s old.json new.json\n" % sys.argv[0])
+  sys.exit(1)
+
+old = load(sys.argv[1])
+new = load(sys.argv[2])
+print("%-24s %10s %10s %8s" % ("benchmark", "old", "new", "change"))
+for name in sorted(set(old.keys()) | set(new.keys())):
+  o = old.get(name, {}).get("avg")
+  n = new.get(name, {}).get("avg")
+  if o is None or n is None:
+    print("%-24s %10s %10s" % (name, o if o is not None else "-", n if n is not None else "-"))
+    continue
+  change = ((n - o) * 100.0 / o) if o else 0.0
+  print("%-24s %10.1f %10.1f %+7.1f%%" % (name, o, n, change))
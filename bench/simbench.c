@@ -0,0 +1,149 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_io.h>
+#include "bench.h"
+
+// runs the benchmark harness in simavr and prints one JSON object per
+// benchmark with cycle counts, so that results can be compared between
+// commits with benchcmp.py
+//
+// usage: simbench bench.elf
+
+#define MAXCYCLES 400000000UL // give up after 50 seconds of target time
+#define SPL 0x5d
+#define SPH 0x5e
+
+static const char *names[BENCH_COUNT] = {
+  "",
+#define BENCH(id,name) name,
+  BENCHMARKS
+#undef BENCH
+};
+
+static struct {
+  uint32_t samples;
+  uint64_t min,max,sum;
+} results[BENCH_COUNT];
+
+static uint8_t region,done;
+static avr_cycle_count_t region_start;
+
+static void record(uint8_t id,uint64_t cycles)
+{
+  if (id==BENCH_NONE || id>=BENCH_COUNT)
+    return;
+  if (!results[id].samples || cycles<results[id].min)
+    results[id].min=cycles;
+  if (cycles>results[id].max)
+    results[id].max=cycles;
+  results[id].sum+=cycles;
+  results[id].samples++;
+}
+
+static void gpior0_write(struct avr_t *avr,avr_io_addr_t addr,uint8_t v,void *param)
+{
+  avr->data[addr]=v;
+  if (v==BENCH_DONE) {
+    done=1;
+    return;
+  }
+  if (v==BENCH_NONE) {
+    if (!BENCH_IS_INTERRUPT(region))
+      record(region,avr->cycle-region_start);
+  }
+  else
+    region_start=avr->cycle;
+  region=v;
+}
+
+static uint16_t sp(avr_t *avr)
+{
+  return avr->data[SPL]|(avr->data[SPH]<<8);
+}
+
+int main(int argc,char *argv[])
+{
+  elf_firmware_t fw;
+  avr_t *avr;
+  uint16_t isr_sp=0;
+  avr_cycle_count_t isr_start=0;
+  uint64_t overhead;
+  int state,i;
+  if (argc!=2) {
+    fprintf(stderr,"usage: %s bench.elf\n",argv[0]);
+    return 1;
+  }
+  memset(&fw,0,sizeof(fw));
+  if (elf_read_firmware(argv[1],&fw)) {
+    fprintf(stderr,"cannot read %s\n",argv[1]);
+    return 1;
+  }
+  avr=avr_make_mcu_by_name("atmega168");
+  if (!avr) {
+    fprintf(stderr,"simavr does not know atmega168\n");
+    return 1;
+  }
+  avr_init(avr);
+  avr->frequency=F_CPU;
+  avr_load_firmware(avr,&fw);
+  avr->log=LOG_NONE;
+  avr_register_io_write(avr,BENCH_GPIOR0,gpior0_write,NULL);
+  do {
+    state=avr_run(avr);
+    if (!isr_sp) {
+      if (avr->pc==BENCH_TIMER0_VECTOR*BENCH_VECTOR_SIZE) {
+        isr_start=avr->cycle;
+        isr_sp=sp(avr);
+      }
+    }
+    else if (sp(avr)>=isr_sp+2) { // reti popped the return address
+      if (BENCH_IS_INTERRUPT(region))
+        record(region,avr->cycle-isr_start);
+      isr_sp=0;
+    }
+  } while (!done && state!=cpu_Done && state!=cpu_Crashed && avr->cycle<MAXCYCLES);
+  if (!done) {
+    fprintf(stderr,"harness did not finish, state %d at cycle %llu\n",state,
+      (unsigned long long)avr->cycle);
+    return 1;
+  }
+  // the marker writes themselves are not part of the measured code
+  overhead=results[BENCH_EMPTY].samples?results[BENCH_EMPTY].min:0;
+  for (i=BENCH_EMPTY+1;i<BENCH_COUNT;i++) {
+    uint64_t o=BENCH_IS_INTERRUPT(i)?0:overhead;
+    if (!results[i].samples)
+      continue;
+    printf("{\"name\": \"%s\", \"samples\": %u, \"min\": %llu, \"avg\": %.1f, \"max\": %llu, \"unit\": \"cycles\"}\n",
+      names[i],results[i].samples,
+      (unsigned long long)(results[i].min-o),
+      (double)results[i].sum/results[i].samples-o,
+      (unsigned long long)(results[i].max-o));
+  }
+  return 0;
+}
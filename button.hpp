@@ -26,14 +26,28 @@ SOFTWARE.
 
 #include <avr/io.h>
 
+// a button created with repeat set repeats its click when held down,
+// in Update() calls of 2.56ms. the step size grows after BUTTON_FAST
+// repeats at each size
+#ifndef BUTTON_DELAY
+#define BUTTON_DELAY 195 // until the first repeat, 0.5s
+#endif
+#ifndef BUTTON_RATE
+#define BUTTON_RATE 59 // between repeats, 0.15s
+#endif
+#define BUTTON_FAST 8
+
 class Button
 {
   uint8_t state,clicks;
+  uint8_t wait,repeats,repeat;
 public:
-  Button()
+  Button(uint8_t repeat=0) : repeat(repeat)
   {
-    state=0;
+    state=0xff; // released, so that the first press registers
     clicks=0;
+    wait=BUTTON_DELAY;
+    repeats=0;
   }
   
   // updates the button with read state that is in bit0 of parameter.
@@ -41,8 +55,28 @@ public:
   void Update(uint8_t b)
   {
     state=(state<<1)|b;
-    if (state==0xf0)
+    if (state) {
+      if (state==0xf0)
+        clicks++;
+      wait=BUTTON_DELAY;
+      repeats=0;
+    }
+    else if (repeat && !--wait) { // held down
       clicks++;
+      wait=BUTTON_RATE;
+      if (repeats<BUTTON_FAST*2)
+        repeats++;
+    }
+  }
+  
+  // step size for a value changed by the clicks, 1, 5 or 10
+  uint8_t Step()
+  {
+    if (repeats>=BUTTON_FAST*2)
+      return 10;
+    if (repeats>=BUTTON_FAST)
+      return 5;
+    return 1;
   }
   
   // read a button click. 1 means clicked, 0 not clicked
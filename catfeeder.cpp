@@ -26,74 +26,219 @@ SOFTWARE.
 #include <avr/eeprom.h>
 #include <avr/sleep.h>
 #include <avr/wdt.h>
+#include <avr/pgmspace.h>
 #include <string.h>
-#include <util/delay.h>
 
+#include "flash.hpp"
+#include "diag.hpp"
+
+extern Diag diag;
+#ifndef clock_transaction
+#define clock_transaction() diag.Count(DIAG_RTC)
+#endif
+
+// a second hopper takes the speaker pin for its sensor
+#if HOPPERS>1
+#define RTTTL_MUTE
+#endif
 #include "rtttl.hpp"
+#include "melodies.hpp"
 #include "avalue.hpp"
 #include "servo.hpp"
 #include "clock.hpp"
 #include "7seg.hpp"
 #include "button.hpp"
+#include "energy.hpp"
+#include "timekeeper.hpp"
 
+#ifndef LOWBATTERYLEVEL
 #define LOWBATTERYLEVEL 440 // low battery threshold in 10mV units
+#endif
+#ifndef SERVINGSIZE
 #define SERVINGSIZE 4 // size of one serving in sensor ticks
+#endif
+#ifndef FEED_RETRIES
+#define FEED_RETRIES 5 // stalls in a row before a feeding is given up
+#endif
+#define EMPTY_TICKS (SERVINGSIZE*2) // fast ticks in a row meaning empty hopper
+#ifndef PULSES_PER_TICK
+#define PULSES_PER_TICK 7 // first guess of servo pulses per sensor tick
+#endif
 #define notRECHARGEABLE_BATTERY // if defined, enables trickle charging
+#define BATTERYCAPACITY 2000 // mAh, for the remaining days projection
+#define FEED_SLACK 4 // seconds the local time may be off from the clock
+#define WAKE_LONG 12 // seconds to next feeding needed for 8 second sleep
 
 #ifndef COUNTOF
 #define COUNTOF(x) (int)(sizeof(x)/sizeof(x[0]))
 #endif
 
+// with a second hopper its sensor takes the speaker pin PB1, and
+// the sensors are powered together with the servos. PB7 then drives
+// the last display digit, see 7seg.hpp
+#if HOPPERS>1
+#define spkr_on()
+#define spkr_off()
+#define spkr_toggle()
+#define sensor_on()
+#define sensor_off()
+#define SENSOR_PIN(h) ((h)?_BV(PB1):_BV(PB6))
+#define SENSOR_PINS (_BV(PB1)|_BV(PB6))
+#define SENSOR_SETTLE 2000 // us after power on
+#define ALERT_HOLD 3000000UL // us a warning stays on the display
+#else
 #define spkr_on() (PORTB=PORTB & ~(_BV(PB1)))
 #define spkr_off() (PORTB=PORTB|_BV(PB1))
 #define spkr_toggle()  (PORTB=PORTB ^ _BV(PB1))
 
 #define sensor_on() (PORTB=PORTB|_BV(PB7))
 #define sensor_off() (PORTB=PORTB&~(_BV(PB7)))
+#define SENSOR_PIN(h) _BV(PB6)
+#define SENSOR_PINS _BV(PB6)
+#endif
 
 // supply voltage meter initial constant
 #define VCCCAL 799
+#ifndef ADC_SETTLE
+// conversions thrown away while the reference settles. the bandgap
+// takes up to 70us to start (40us typical), at the 1MHz ADC clock the
+// first conversion takes 25us and the next ones 13us each, five of
+// them cover 77us
+#define ADC_SETTLE 5
+#endif
+#ifndef VCC_SHIFT
+#define VCC_SHIFT 4 // 2^VCC_SHIFT conversions averaged per measurement
+#endif
+
+#define FEEDINGS 32 // schedule entries
+#define ALLDAYS 0x7f // weekday mask, bit 0 is clock day 1
 
+// one schedule entry packed into three bytes, four with more
+// than one hopper
 typedef struct {
-  uint8_t h, // hour
-          m, // minute
-          s; // servings
-} FEEDINGTIME;
-
-FEEDINGTIME EEMEM ee_feeding_schedule[10] = {
-  { 7,00,6 },
-  { 17,00,6 },
-  { 22,30,6 },
-  { 0,0,0 },
-  { 0,0,0 },
-  { 0,0,0 },
-  { 0,0,0 },
-  { 0,0,0 },
-  { 0,0,0 },
-  { 0,0,0 },
+  uint32_t minute:11,  // minute of day
+           servings:6, // 0 disables the entry
+#if HOPPERS>1
+           days:7,     // weekdays to feed on
+           hopper:2;   // 0 feeds from every hopper, 1.. from one
+#else
+           days:7;     // weekdays to feed on
+#endif
+} __attribute__((packed)) FEEDINGTIME;
+
+FEEDINGTIME EEMEM ee_feeding_schedule[FEEDINGS] = {
+  { 7*60+00,6,ALLDAYS },
+  { 17*60+00,6,ALLDAYS },
+  { 22*60+30,6,ALLDAYS },
 };
 
 uint16_t EEMEM ee_calibration=VCCCAL;
+// servo speed relative to SERVO_NOMINAL in 1/128 units, at supply
+// voltages from SERVO_CURVE_LOW up in SERVO_CURVE_STEP steps
+#define SERVO_NOMINAL 500 // 10mV units
+#define SERVO_CURVE_LOW 360
+#define SERVO_CURVE_STEP 40
+#define SERVO_CURVE_POINTS 5
+uint8_t EEMEM ee_servo_curve[SERVO_CURVE_POINTS] = { 92,102,113,123,133 };
+uint16_t EEMEM ee_pulses[HOPPERS] = {
+  PULSES_PER_TICK*16,
+#if HOPPERS>1
+  PULSES_PER_TICK*16
+#endif
+};
+
+// the last feeding that had to be given up, kept in eeprom so
+// that it is not tried again after a reset
+enum { FAULT_NONE, FAULT_JAM, FAULT_EMPTY };
+typedef struct
+{
+  uint8_t kind;
+  uint8_t day;
+  uint16_t minute;
+} FAULT;
+FAULT EEMEM ee_fault;
+
+// state of charge of 4 NiMH cells against the battery voltage in 10mV
+// units, from full down to empty
+#define SOC_POINTS 8
+const uint8_t soc_percent[SOC_POINTS] PROGMEM = { 100,95,80,50,20,10,5,0 };
+const uint16_t soc_voltage[SOC_POINTS] PROGMEM = { 560,520,500,488,472,448,420,380 };
+
+// supply current in uA for each energy bucket
+const uint32_t energy_current[ENERGY_BUCKETS] PROGMEM = {
+  11300, // full power, CPU mostly idle and movement sensor lit
+  1300,  // low power, CPU idle
+  28,    // power down, includes the short watchdog wakeups
+  57000, // servo powered, average over a feeding
+  15000, // speaker
+  18000  // display digit lit
+};
 
 //
-FEEDINGTIME feeding_schedule[COUNTOF(ee_feeding_schedule)];
-uint8_t feeding_date[10];
-uint32_t scheduletimer;
-Servo servo;
+// kept sorted by time, the enabled entries first
+FEEDINGTIME feeding_schedule[FEEDINGS];
+uint8_t feeding_date[FEEDINGS];
+uint8_t feedings; // number of enabled entries
+uint32_t batterytimer;
+uint8_t wakeperiods=1; // length of current sleep in 2 second periods
+int16_t checked=-1; // minute of day the clock showed the feedings of done
+uint16_t pulses_per_tick[HOPPERS]; // learned servo pulses per sensor tick at nominal voltage, 1/16 units
+uint8_t servo_speed=128; // servo speed at the current voltage, 1/128 units
+uint16_t dispense_rate; // servings per second in the last feeding, 1/100 units
+FAULT fault;
+uint8_t due_day; // date and time of the feeding found by feeding_time()
+uint16_t due_minute;
+// state of one hopper during a feeding
+enum { HOPPER_DONE, HOPPER_START, HOPPER_FORWARD, HOPPER_BACK, HOPPER_PAUSE };
+typedef struct
+{
+  uint8_t state;
+  uint16_t ticks;  // sensor ticks still to go
+  uint8_t budget;  // servo pulses given to the step in progress
+  uint8_t retries; // stalls in a row
+  uint8_t fast;    // fast ticks in a row
+  uint8_t soft;    // the next step forward is ramped
+  uint8_t kind;    // FAULT_NONE, or why the hopper was given up
+  uint32_t pulses; // servo pulses used
+  uint32_t limit;
+  uint32_t since;  // awake time the pause after a stall started
+} HOPPER;
+HOPPER hopper[HOPPERS];
+volatile uint8_t sensor_edge; // bit per hopper, set by the sensor interrupt on a rising edge
+volatile uint8_t sensor_last; // sensor levels the interrupt saw last
+volatile uint16_t sensor_left[HOPPERS]; // servo pulses that were still to go at the edge
+#if HOPPERS>1
+Servo servo[HOPPERS] = { Servo(SERVO_OC2B), Servo(SERVO_OC2A) };
+#else
+Servo servo[HOPPERS];
+#endif
 Clock clock;
+TimeKeeper timekeeper;
 Display display;
 typedef enum { NONE,PLUS,MINUS,ENTER } BUTTON;
-Button minus_button,plus_button,enter_button;
-Avalue vcc;
+Button minus_button(1),plus_button(1),enter_button;
+// the lowest and highest conversion of a measurement are left out,
+// the servo current makes short dips in the supply
+Avalue<VCC_SHIFT,AVALUE_TRIM> vcc;
+uint16_t battery_scale; // 10mV units per ADC step, 1/65536 units
+volatile uint8_t adc_count; // conversions still to take
 RTTTL player;
+Energy energy __attribute__((section(".noinit")));
+Diag diag __attribute__((section(".noinit")));
 enum { FULL, LOW, POWERSAVE };
 int8_t powermode=FULL;
-const char *menu[] = { "BAT", "CLK", "SCH","TST","CAL" };
-enum { MENU_BAT,MENU_CLK,MENU_SCH,MENU_TST,MENU_CAL };
-const char *edit_menu[] = { "HRS", "MIN", "SRV" };
-enum { EDIT_HRS,EDIT_MIN,EDIT_SRV };
-const char * select_menu[]={"F 1","F 2","F 3","F 4","F 5","F 6","F 7","F 8","F 9","F10"};
-const char *clock_menu[] =  { "HRS","MIN","DAY","MON","YEA" };
+// menu items are all three characters, kept in flash
+const char menu[][4] PROGMEM = { "BAT", "DAY", "CLK", "SCH","TST","CAL","DIA" };
+enum { MENU_BAT,MENU_DAY,MENU_CLK,MENU_SCH,MENU_TST,MENU_CAL,MENU_DIA };
+// the counters, then learned pulses per tick and the dispense rate
+const char diag_menu[][4] PROGMEM = { "TMR","WDT","PCI","RTC","EEP","PUL","STF","NOT","RST","ABT","SLP","PPT","SPS" };
+#if HOPPERS>1
+const char edit_menu[][4] PROGMEM = { "HRS", "MIN", "SRV", "DAY", "HOP" };
+#else
+const char edit_menu[][4] PROGMEM = { "HRS", "MIN", "SRV", "DAY" };
+#endif
+enum { EDIT_HRS,EDIT_MIN,EDIT_SRV,EDIT_DAY,EDIT_HOP };
+const char clock_menu[][4] PROGMEM =  { "HRS","MIN","DAY","MON","YEA" };
 enum { CLOCK_HRS,CLOCK_MIN,CLOCK_DAY,CLOCK_MON,CLOCK_YEA };
 uint32_t menutimer;
 
@@ -118,9 +263,11 @@ void lowpower(void)
 
 void powersave(void)
 {
+uint8_t h;
   powermode=POWERSAVE;
   display.Off();
-  servo.Off();
+  for (h=0;h<HOPPERS;h++)
+    servo[h].Off();
   spkr_off();
   sensor_off();
   PORTC=6; // make sure pullups are enabled on plus and minus button
@@ -128,24 +275,19 @@ void powersave(void)
   set_sleep_mode(SLEEP_MODE_PWR_DOWN);
 }
 
+// any button press brings the display back to full brightness
 BUTTON readbutton(void)
 {
+BUTTON b=NONE;
   if (minus_button.Read())
-    return MINUS;
-  if (plus_button.Read())
-    return PLUS;
-  if (enter_button.Read())
-    return ENTER;
-  return NONE;
-}
-
-void ServoWait()
-{
-  while (servo.Active()) {
-    sleep_cpu();
-    wdt_reset();
-    WDTCSR|=0x40;
-  }
+    b=MINUS;
+  else if (plus_button.Read())
+    b=PLUS;
+  else if (enter_button.Read())
+    b=ENTER;
+  if (b!=NONE)
+    display.Wake();
+  return b;
 }
 
 // there is a 10K+68K voltage divider on VCC
@@ -153,20 +295,128 @@ void ServoWait()
 // calculating in millivolts this voltage is adcvalue*1100/1024
 // the result then needs to be scaled up by the same ratio as
 // voltage divider, the scaling factor is read from eeprom and
-// can be adjusted through menu
+// can be adjusted through menu. it is kept in RAM as a single
+// multiplier for the ADC value
+void battery_calibrate(void)
+{
+  battery_scale=(uint32_t)eeprom_read_word(&ee_calibration)*704/10;
+}
+
+int16_t battery_voltage(uint16_t adc)
+{
+  return ((uint32_t)adc*battery_scale)>>16;
+}
+
+// the ADC and its reference are only powered up for a measurement.
+// the CPU sleeps in ADC noise reduction mode until the ADC interrupt
+// has collected an average. the timers stop for that time, well under
+// a millisecond, so while a melody plays the CPU only idles
+uint16_t battery_measure(void)
+{
+uint8_t smcr=SMCR;
+  vcc.Clear();
+  adc_count=vcc.SAMPLES+ADC_SETTLE;
+  PRR&=~_BV(PRADC);
+  ADCSRA=0x8b; // enabled, interrupt, prescaler 8
+  set_sleep_mode(TCCR1B?SLEEP_MODE_IDLE:SLEEP_MODE_ADC);
+  while (adc_count) {
+    ADCSRA|=_BV(ADSC); // no effect if a conversion is running
+    sleep_cpu();
+  }
+  ADCSRA=0;
+  PRR|=_BV(PRADC);
+  SMCR=smcr;
+  return vcc.Get();
+}
+
 int16_t read_battery_voltage(void)
 {
-uint32_t v;
-  v=vcc.Get();
-  v=(v*1100L)/1024L;
-  v=(v*(int32_t)eeprom_read_word(&ee_calibration))/1000L;
-  return (uint16_t)v;
+  return battery_voltage(battery_measure());
+}
+
+// state of charge in percent, interpolated from the discharge curve
+uint8_t battery_charge(int16_t v)
+{
+uint8_t i;
+int16_t hi,lo;
+  for (i=1;i<SOC_POINTS-1;i++) {
+    if (v>=(int16_t)flash_read(&soc_voltage[i]))
+      break;
+  }
+  hi=flash_read(&soc_voltage[i-1]);
+  lo=flash_read(&soc_voltage[i]);
+  if (v>=hi)
+    return flash_read(&soc_percent[i-1]);
+  if (v<=lo)
+    return flash_read(&soc_percent[i]);
+  return flash_read(&soc_percent[i])+(v-lo)*
+    (flash_read(&soc_percent[i-1])-flash_read(&soc_percent[i]))/(hi-lo);
 }
 
+// the voltage is measured once a second, PLUS and MINUS switch
+// between it and the state of charge
 void showbattery(void)
 {
-  while (clock.SecondsPassed(menutimer)<10) {
-    display.printd(read_battery_voltage());
+uint32_t t,measured=10;
+int16_t v=0;
+uint8_t charge=0,c;
+  while ((t=timekeeper.SecondsPassed(menutimer))<10) {
+    if (t!=measured) {
+      v=read_battery_voltage();
+      measured=t;
+    }
+    if (charge) {
+      c=battery_charge(v);
+      display.putc('\r');
+      display.putc(c>99?'1':' ');
+      display.putc(c>9?(c/10)%10+'0':' ');
+      display.putc(c%10+'0');
+    }
+    else
+      display.printd(v);
+    switch (readbutton()) {
+      case PLUS:
+      case MINUS:
+        charge=!charge;
+        menutimer=timekeeper.Now();
+        break;
+      case ENTER:
+        return;
+      default:
+        break;
+    }
+    sleep_cpu();
+    wdt_reset();
+    WDTCSR|=0x40;
+  }
+}
+
+// days left in the battery at the average current drawn since
+// the batteries were put in, 0 if it is too early to tell
+uint16_t remaining_days(void)
+{
+uint32_t elapsed,charge,avg,left;
+  elapsed=energy.Elapsed();
+  if (elapsed<3600)
+    return 0;
+  charge=energy.Charge(energy_current);
+  avg=(charge*125L)/(elapsed/8); // uA
+  if (!avg)
+    avg=1;
+  if (charge/3600>=BATTERYCAPACITY)
+    return 0;
+  left=(BATTERYCAPACITY-charge/3600)*1000L/(avg*24);
+  return left>999?999:left;
+}
+
+void showdays(void)
+{
+uint16_t days=remaining_days();
+  while (timekeeper.SecondsPassed(menutimer)<10) {
+    if (days)
+      display.printd(days);
+    else
+      display.puts_P(PSTR("\r---"));
     if (readbutton()!=NONE)
       break;
     sleep_cpu();
@@ -175,23 +425,93 @@ void showbattery(void)
   }
 }
 
-// modify value in BCD form
+// show a counter, thousands with K
+void printcount(uint16_t v)
+{
+  if (v<1000) {
+    display.printd(v);
+    return;
+  }
+  v/=1000;
+  display.putc('\r');
+  display.putc(v>9?v/10+'0':' ');
+  display.putc(v%10+'0');
+  display.putc('K');
+}
+
+// pulses per tick of the first hopper shown in tenths, dispense
+// rate in hundredths
+uint16_t diagvalue(uint8_t item)
+{
+  if (item<DIAG_COUNTERS)
+    return diag.Get(item);
+  if (item==DIAG_COUNTERS)
+    return pulses_per_tick[0]*10/16;
+  return dispense_rate;
+}
+
+// page through diagnostic counters with plus and minus, the
+// display alternates between counter name and value
+void showdiag(void)
+{
+int8_t item=0;
+uint32_t t;
+  menutimer=timekeeper.Now();
+  while ((t=timekeeper.SecondsPassed(menutimer))<10) {
+    wdt_reset();
+    WDTCSR|=0x40;
+    if (t&1)
+      printcount(diagvalue(item));
+    else {
+      display.putc('\r');
+      display.puts_P(diag_menu[item]);
+    }
+    switch (readbutton()) {
+      case PLUS:
+        if (item<COUNTOF(diag_menu)-1)
+          item++;
+        menutimer=timekeeper.Now();
+        break;
+      case MINUS:
+        if (item>0)
+          item--;
+        menutimer=timekeeper.Now();
+        break;
+      case ENTER:
+        return;
+      default:
+        break;
+    }
+    sleep_cpu();
+  }
+}
+
+// modify value in BCD form. a held button repeats in steps that
+// grow from 1 to 5 and 10, the value goes to multiples of the step
 uint16_t entervalue(uint16_t value,uint16_t min,uint16_t max)
 {
-  while (clock.SecondsPassed(menutimer)<10) {
+uint8_t step;
+  while (timekeeper.SecondsPassed(menutimer)<10) {
     wdt_reset();
     WDTCSR|=0x40;
     display.printd(value);
     switch (readbutton()) {
       case PLUS:
-        if (value<max)
-          value++;
-        menutimer=clock.ReadDayTime();
+        step=plus_button.Step();
+        value+=step-value%step;
+        if (value>max)
+          value=max;
+        menutimer=timekeeper.Now();
         break;
       case MINUS:
-        if (value>min)
-          value--;
-        menutimer=clock.ReadDayTime();
+        step=minus_button.Step();
+        if (value%step)
+          step=value%step;
+        if (value>=min+step)
+          value-=step;
+        else
+          value=min;
+        menutimer=timekeeper.Now();
         break;
       case ENTER:
         return value;
@@ -202,82 +522,314 @@ uint16_t entervalue(uint16_t value,uint16_t min,uint16_t max)
   return value;
 }
 
-bool StepBack()
+// servo pulses allowed for one sensor tick before the wheel is
+// considered stalled, a quarter more than it usually takes
+uint8_t tick_budget(uint8_t h)
 {
-uint8_t sensor=PINB&0x40;
-  servo.Right(10);
-  while (servo.Active()) {
-    if ((PINB&0x40) && !sensor) {
-      servo.Stop();
-      return true;
-    }
-    sensor=PINB&0x40;
-    wdt_reset();
-    WDTCSR|=0x40;
+  return ((uint32_t)pulses_per_tick[h]*160/servo_speed+15)/16+1;
+}
+
+// average the pulses it took to make a sensor tick into the estimate
+void tick_learn(uint8_t h,uint16_t pulses)
+{
+int16_t p=((uint32_t)pulses*16*servo_speed)/128; // at nominal voltage
+  pulses_per_tick[h]+=(p-(int16_t)pulses_per_tick[h])/8;
+}
+
+// relative servo speed at the given voltage, interpolated from the
+// curve in eeprom. above nominal the speed command is turned down,
+// so that the wheel goes as fast as at nominal voltage
+void servo_compensate(int16_t v)
+{
+uint8_t i,a,b,s=128;
+int16_t f;
+  if (v<=0) // no reading yet
+    v=SERVO_NOMINAL;
+  if (v<SERVO_CURVE_LOW)
+    v=SERVO_CURVE_LOW;
+  i=(v-SERVO_CURVE_LOW)/SERVO_CURVE_STEP;
+  if (i>=SERVO_CURVE_POINTS-1) {
+    i=SERVO_CURVE_POINTS-2;
+    v=SERVO_CURVE_LOW+(SERVO_CURVE_POINTS-1)*SERVO_CURVE_STEP;
+  }
+  a=eeprom_read_byte(&ee_servo_curve[i]);
+  b=eeprom_read_byte(&ee_servo_curve[i+1]);
+  f=a+((int16_t)b-a)*(v-SERVO_CURVE_LOW-i*SERVO_CURVE_STEP)/SERVO_CURVE_STEP;
+  if (f<32) // erased or garbage
+    f=128;
+  if (f>128) {
+    s=128*128/f;
+    f=128;
+  }
+  for (i=0;i<HOPPERS;i++)
+    servo[i].Scale(s);
+  servo_speed=f;
+}
+
+// start turning the wheel of a hopper by one sensor tick, with at most
+// the given number of servo pulses. the sensor interrupt stops the
+// servo when it sees a rising edge
+void step(uint8_t h,bool forward,uint8_t pulses,const ServoProfile& profile)
+{
+uint8_t m=SENSOR_PIN(h);
+  hopper[h].budget=pulses;
+  // the move is started first, an edge the interrupt takes must find
+  // the pulses it stops set up
+  if (forward)
+    servo[h].Left(pulses,profile);
+  else
+    servo[h].Right(pulses,profile);
+  cli();
+  sensor_edge&=~_BV(h);
+  sensor_last=(sensor_last&~m)|(PINB&m); // changes from before are no edge
+  PCMSK0|=m;
+  PCICR|=_BV(PCIE0);
+  sei();
+}
+
+// true when the edge came or the pulses ran out
+bool step_over(uint8_t h)
+{
+  return (sensor_edge&_BV(h)) || !servo[h].Active();
+}
+
+// returns the servo pulses the step took, 0 if the wheel stalled
+uint8_t step_end(uint8_t h)
+{
+HOPPER& hp=hopper[h];
+  cli();
+  PCMSK0&=~SENSOR_PIN(h);
+  if (!(PCMSK0&SENSOR_PINS))
+    PCICR&=~_BV(PCIE0);
+  sei();
+  if (sensor_edge&_BV(h)) {
+    hp.pulses+=hp.budget-sensor_left[h];
+    if (sensor_left[h]>=hp.budget) // the wheel was still coasting
+      return 1;
+    return hp.budget-sensor_left[h];
   }
-  servo.Stop();
+  servo[h].Stop();
+  hp.pulses+=hp.budget;
+  return 0;
+}
+
+// stop the wheel of a hopper for a while. the sensors of more than one
+// hopper share the servo power, it then stays on until the feeding ends
+void hopper_rest(uint8_t h)
+{
+#if HOPPERS>1
+  servo[h].Halt();
+#else
+  servo[h].Off();
+#endif
+}
+
+// a hopper that is given up stops right away, the others go on
+bool hopper_stop(uint8_t h,uint8_t kind)
+{
+  hopper[h].kind=kind;
+  hopper[h].state=HOPPER_DONE;
+  hopper_rest(h);
   return false;
 }
 
-bool StepForward()
+// move a hopper on when its step or pause is over, returns false once
+// it is done. a stalled wheel is backed off and tried again after a
+// pause that doubles each time, the motor time is limited too. the
+// first tick and the ones after backing off are ramped, a ramped tick
+// takes more pulses and says nothing of the wheel
+bool hopper_update(uint8_t h)
 {
-uint8_t sensor=PINB&0x40;
-  servo.Left(10);
-  while (servo.Active()) {
-    if ((PINB&0x40) && !sensor) {
-      servo.Stop();
+HOPPER& hp=hopper[h];
+uint8_t p;
+const ServoProfile *profile;
+  switch (hp.state) {
+    case HOPPER_DONE:
+      return false;
+    case HOPPER_START:
+      break;
+    case HOPPER_PAUSE:
+      if (timekeeper.Awake()-hp.since<(100UL<<hp.retries)*1000UL)
+        return true;
+      // reversing draws the most current, always ramped
+      step(h,false,tick_budget(h)+servo_soft.up,servo_soft);
+      hp.state=HOPPER_BACK;
       return true;
-    }
-    sensor=PINB&0x40;
+    case HOPPER_BACK:
+      if (!step_over(h))
+        return true;
+      step_end(h);
+      hp.soft=1;
+      break;
+    case HOPPER_FORWARD:
+      if (!step_over(h))
+        return true;
+      p=step_end(h);
+      if (!p) {
+        diag.Count(DIAG_STEPFAIL);
+        if (++hp.retries>FEED_RETRIES)
+          return hopper_stop(h,FAULT_JAM);
+        hopper_rest(h);
+        hp.since=timekeeper.Awake();
+        hp.state=HOPPER_PAUSE;
+        return true;
+      }
+      hp.retries=0;
+      hp.ticks--;
+      if (hp.soft)
+        hp.soft=0;
+      // without food the wheel turns clearly faster than it has learned
+      else if ((uint16_t)p*48<pulses_per_tick[h]*2) {
+        if (++hp.fast>=EMPTY_TICKS)
+          return hopper_stop(h,FAULT_EMPTY);
+      }
+      else {
+        hp.fast=0;
+        tick_learn(h,p);
+      }
+      break;
+  }
+  if (!hp.ticks) {
+    hp.state=HOPPER_DONE;
+    return false;
+  }
+  if (hp.pulses>hp.limit)
+    return hopper_stop(h,FAULT_JAM);
+  profile=hp.soft?&servo_soft:&servo_hard;
+  step(h,true,tick_budget(h)+profile->up,*profile);
+  hp.state=HOPPER_FORWARD;
+  return true;
+}
+
+#ifdef RTTTL_MUTE
+// without the speaker a warning has no melody to last for,
+// keep it on the display for ALERT_HOLD instead
+void hold(void)
+{
+uint32_t start;
+  fullpower();
+  start=timekeeper.Awake();
+  while (timekeeper.Awake()-start<ALERT_HOLD) {
+    sleep_cpu();
     wdt_reset();
     WDTCSR|=0x40;
   }
-  servo.Stop();
-  return false;
+}
+#endif
+
+// a given up feeding is told with a melody and shown
+// on the display until the melody ends
+void alert(uint8_t kind)
+{
+  display.puts_P(kind==FAULT_EMPTY?PSTR("\rEMP"):PSTR("\rJAM"));
+  player.Play(melody_alert);
+#ifdef RTTTL_MUTE
+  hold();
+#endif
 }
 
-void do_feeding(uint8_t servings,uint8_t playmusic=1)
+// feed the given servings from each hopper, returns FAULT_NONE or why
+// a hopper was given up. the hoppers step at the same time, the CPU
+// sleeps until a step of any of them is over
+uint8_t do_feeding(const uint8_t *servings,uint8_t playmusic=1)
 {
+uint8_t h,busy,kind=FAULT_NONE;
+uint16_t saved,total=0;
+uint32_t start,ms;
   display.Clear();
   fullpower();
+  display.Off(); // nobody is watching, save the current for the servo
+  servo_compensate(read_battery_voltage());
   if (playmusic)
-    player.Play("Beethoven - Fur Elise : d=4,o=5,b=160:8e7,8d#7,8e7,8d#7,8e7,8b6,8d7,8c7,8a6,8e,8a,8c6,8e6,8a6,8b6,8e,8g#,8e6,8g#6,8b6,8c7,8e,8a,8e6,8e7,8d#7,8e7,8d#7,8e7,8b6,8d7,8c7,8a6,8e,8a,8c6,8e6,8a6,8b6,8e,8g#,8e6,8c7,8b6,2a6,");
-  servings*=SERVINGSIZE;
-  while (servings)
-  {
-    if (!StepForward())
-    {
-      servo.Off();
-      _delay_ms(200);
-      StepBack();
+    player.Play(melody_elise);
+  start=timekeeper.Awake();
+#if HOPPERS>1
+  // the sensors come on with the servo power, give them a timer tick
+  // to settle before the first step takes their levels
+  servo_power_on();
+  while (timekeeper.Awake()-start<SENSOR_SETTLE)
+    sleep_cpu();
+  start=timekeeper.Awake();
+#endif
+  for (h=0;h<HOPPERS;h++) {
+    memset(&hopper[h],0,sizeof(HOPPER));
+    hopper[h].ticks=servings[h]*SERVINGSIZE;
+    hopper[h].limit=((uint32_t)hopper[h].ticks+SERVINGSIZE*2)*tick_budget(h)*2;
+    hopper[h].soft=1; // the wheel starts from rest
+    hopper[h].state=hopper[h].ticks?HOPPER_START:HOPPER_DONE;
+    total+=servings[h];
+  }
+  while (1) {
+    busy=0;
+    for (h=0;h<HOPPERS;h++)
+      busy|=hopper_update(h);
+    if (!busy)
+      break;
+    sleep_cpu();
+    wdt_reset();
+    WDTCSR|=0x40;
+  }
+  for (h=0;h<HOPPERS;h++) {
+    servo[h].Off();
+    if (!kind)
+      kind=hopper[h].kind;
+  }
+  if (kind) {
+    diag.Count(DIAG_ABORTS);
+    alert(kind);
+  }
+  else {
+    ms=(timekeeper.Awake()-start)/1000;
+    if (ms)
+      dispense_rate=(uint32_t)total*100000L/ms;
+  }
+  for (h=0;h<HOPPERS;h++) {
+    // keep the estimate over resets, but only write when it has
+    // moved by half a pulse
+    saved=eeprom_read_word(&ee_pulses[h]);
+    if (pulses_per_tick[h]>=saved+8 || saved>=pulses_per_tick[h]+8) {
+      eeprom_write_word(&ee_pulses[h],pulses_per_tick[h]);
+      diag.Add(DIAG_EEPROM,2);
     }
-    else
-      servings--;
   }
-  servo.Off();
   enter_button.Clear();
+  display.On();
+  return kind;
+}
+
+// remember a given up scheduled feeding, or forget it after one
+// that went well
+void record_fault(uint8_t kind)
+{
+  if (!kind && !fault.kind)
+    return;
+  fault.kind=kind;
+  fault.day=due_day;
+  fault.minute=due_minute;
+  eeprom_write_block(&fault,&ee_fault,sizeof(fault));
+  diag.Add(DIAG_EEPROM,sizeof(fault));
 }
 
 void clock_edit()
 {
 uint8_t h,m,s,Y,M,D,w;
 int8_t item=0;
-  menutimer=clock.ReadDayTime();
-  while (clock.SecondsPassed(menutimer)<10) {
+  menutimer=timekeeper.Now();
+  while (timekeeper.SecondsPassed(menutimer)<10) {
     wdt_reset();
     WDTCSR|=0x40;
     display.putc('\r');
-    display.puts(clock_menu[item]);
+    display.puts_P(clock_menu[item]);
     switch (readbutton()) {
       case PLUS:
         if (item<COUNTOF(clock_menu)-1)
           item++;
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       case MINUS:
         if (item>0)
           item--;
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       case ENTER:
         clock.ReadDateTime(Y,M,D,h,m,s,w);
@@ -301,7 +853,7 @@ int8_t item=0;
             break;
         }
         clock.ChangeDateTime(Y,M,D,h,m,s,w);        
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       default:
         break;
@@ -309,25 +861,49 @@ int8_t item=0;
   }
 }
 
-void schedule_edit(uint8_t& h,uint8_t& m,uint8_t& servings)
+// weekdays are picked in the schedule editor by a code,
+// 0 is every day, 1..7 a single day, 8 days 1..5, 9 days 6..7
+uint8_t daymask(uint8_t code)
+{
+  if (code==0 || code>9)
+    return ALLDAYS;
+  if (code<8)
+    return 1<<(code-1);
+  if (code==8)
+    return 0x1f;
+  return 0x60;
+}
+
+uint8_t daycode(uint8_t mask)
+{
+uint8_t c;
+  for (c=0;c<10;c++) {
+    if (daymask(c)==mask)
+      return c;
+  }
+  return 0;
+}
+
+void schedule_edit(FEEDINGTIME& entry)
 {
 int8_t item=0;
-  menutimer=clock.ReadDayTime();
-  while (clock.SecondsPassed(menutimer)<10) {
+uint8_t h=entry.minute/60,m=entry.minute%60;
+  menutimer=timekeeper.Now();
+  while (timekeeper.SecondsPassed(menutimer)<10) {
     wdt_reset();
     WDTCSR|=0x40;
     display.putc('\r');
-    display.puts(edit_menu[item]);
+    display.puts_P(edit_menu[item]);
     switch (readbutton()) {
       case PLUS:
         if (item<COUNTOF(edit_menu)-1)
           item++;
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       case MINUS:
         if (item>0)
           item--;
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       case ENTER:
         switch (item) {
@@ -338,10 +914,19 @@ int8_t item=0;
             m=entervalue(m,0,59);
             break;
           case EDIT_SRV: // lft
-            servings=entervalue(servings,0,40);
+            entry.servings=entervalue(entry.servings,0,40);
+            break;
+          case EDIT_DAY:
+            entry.days=daymask(entervalue(daycode(entry.days),0,9));
             break;
+#if HOPPERS>1
+          case EDIT_HOP:
+            entry.hopper=entervalue(entry.hopper,0,HOPPERS);
+            break;
+#endif
         }
-        menutimer=clock.ReadDayTime();
+        entry.minute=h*60+m;
+        menutimer=timekeeper.Now();
         break;
       default:
         break;
@@ -349,33 +934,90 @@ int8_t item=0;
   }
 }
 
+// entries of an erased EEPROM or an older layout are cleared before
+// they reach the sorted lookup, a time past midnight or a hopper that
+// is not there would be taken as they are
+void schedule_check(void)
+{
+uint8_t i;
+  for (i=0;i<FEEDINGS;i++) {
+    if (feeding_schedule[i].minute>=24*60
+#if HOPPERS>1
+        || feeding_schedule[i].hopper>HOPPERS
+#endif
+        ) {
+      memset(&feeding_schedule[i],0,sizeof(FEEDINGTIME));
+      feeding_schedule[i].days=ALLDAYS;
+    }
+  }
+}
+
+// insertion sort by time with disabled entries last, the
+// feeding dates move along so that nothing is fed twice
+void schedule_sort(void)
+{
+uint8_t i,j,d;
+FEEDINGTIME e;
+uint16_t k;
+  feedings=0;
+  for (i=0;i<FEEDINGS;i++) {
+    e=feeding_schedule[i];
+    d=feeding_date[i];
+    k=e.servings?e.minute:0x800|e.minute;
+    for (j=i;j>0;j--) {
+      if ((feeding_schedule[j-1].servings?feeding_schedule[j-1].minute:
+        0x800|feeding_schedule[j-1].minute)<=k)
+        break;
+      feeding_schedule[j]=feeding_schedule[j-1];
+      feeding_date[j]=feeding_date[j-1];
+    }
+    feeding_schedule[j]=e;
+    feeding_date[j]=d;
+    if (e.servings)
+      feedings++;
+  }
+}
+
+// write back the bytes that changed
+void schedule_save(void)
+{
+uint16_t i;
+uint8_t *p=(uint8_t*)feeding_schedule,*e=(uint8_t*)ee_feeding_schedule;
+  for (i=0;i<sizeof(feeding_schedule);i++) {
+    if (eeprom_read_byte(e+i)!=p[i]) {
+      eeprom_write_byte(e+i,p[i]);
+      diag.Count(DIAG_EEPROM);
+    }
+  }
+}
+
 void schedule_select(void)
 {
 int8_t item=0;
-  menutimer=clock.ReadDayTime();
-  while (clock.SecondsPassed(menutimer)<10) {
+  menutimer=timekeeper.Now();
+  while (timekeeper.SecondsPassed(menutimer)<10) {
     wdt_reset();
     WDTCSR|=0x40;
     display.putc('\r');
-    display.puts(select_menu[item]);
+    display.putc('F');
+    display.putc(item>8?(item+1)/10+'0':' ');
+    display.putc((item+1)%10+'0');
     switch (readbutton()) {
       case PLUS:
-        if (item<COUNTOF(select_menu)-1)
+        if (item<FEEDINGS-1)
           item++;
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       case MINUS:
         if (item>0)
           item--;
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       case ENTER:
-        schedule_edit(feeding_schedule[item].h,feeding_schedule[item].m,
-          feeding_schedule[item].s);
-        eeprom_write_byte(&ee_feeding_schedule[item].h,feeding_schedule[item].h);
-        eeprom_write_byte(&ee_feeding_schedule[item].m,feeding_schedule[item].m);
-        eeprom_write_byte(&ee_feeding_schedule[item].s,feeding_schedule[item].s);
-        menutimer=clock.ReadDayTime();
+        schedule_edit(feeding_schedule[item]);
+        schedule_sort();
+        schedule_save();
+        menutimer=timekeeper.Now();
         break;
       default:
         break;
@@ -387,34 +1029,38 @@ void do_menu(void)
 {
 int8_t item=0;
 uint16_t v;
+uint8_t servings[HOPPERS];
   fullpower();
 #ifdef RECHARGEABLE_BATTERY
   clock.EnableCharging();
 #endif
-  menutimer=clock.ReadDayTime();
-  while (readbutton()==NONE); // it takes few timer ticks for button press to register
-                              // wait for it, so that the wakeup press is ignored
-  while (clock.SecondsPassed(menutimer)<10) {
+  menutimer=timekeeper.Now();
+  while (readbutton()==NONE) // it takes few timer ticks for button press to register
+    sleep_cpu();             // wait for it, so that the wakeup press is ignored
+  while (timekeeper.SecondsPassed(menutimer)<10) {
     wdt_reset();
     WDTCSR|=0x40;
     display.putc('\r');
-    display.puts(menu[item]);
+    display.puts_P(menu[item]);
     switch (readbutton()) {
       case PLUS:
         if (item<COUNTOF(menu)-1)
           item++;
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       case MINUS:
         if (item>0)
           item--;
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       case ENTER:
         switch (item) {
           case MENU_BAT:
             showbattery();
             break;
+          case MENU_DAY:
+            showdays();
+            break;
           case MENU_CLK:
             clock_edit();
             break;
@@ -422,39 +1068,117 @@ uint16_t v;
             schedule_select();            
             break;
           case MENU_TST: // tst
-            do_feeding(10,0);
+            memset(servings,10,sizeof(servings));
+            do_feeding(servings,0);
+            break;
+          case MENU_DIA:
+            showdiag();
             break;
           case MENU_CAL: // cal
             v=eeprom_read_word(&ee_calibration);
             v=entervalue(v,750,850);
             eeprom_write_word(&ee_calibration,v);
+            diag.Add(DIAG_EEPROM,2);
+            battery_calibrate();
             break;
         }
-        menutimer=clock.ReadDayTime();
+        menutimer=timekeeper.Now();
         break;
       default:
         break;
     }
   }
+  // the wakeup cut a watchdog period short and the clock may
+  // have been changed, take the time from the clock again
+  timekeeper.Sync(clock.ReadDayTime(),false);
+}
+
+// seconds until the next feeding by the local time,
+// 0 if one is due now and -1 if nothing is scheduled.
+// an entry is due for its whole minute with some slack
+// around it, the real time clock then decides. the
+// weekdays are only known to the clock
+//
+int32_t next_feeding(void)
+{
+uint8_t lo,hi,i;
+int32_t now,t;
+  if (!feedings)
+    return -1;
+  now=timekeeper.Now();
+  // a check only counts in the window of its minute, the same minute
+  // of the next day must not be skipped
+  if (checked>=0) {
+    t=now-checked*60L;
+    if (t<0)
+      t+=SECONDS_PER_DAY;
+    if (t>60+FEED_SLACK && t<SECONDS_PER_DAY-FEED_SLACK)
+      checked=-1;
+  }
+  // find the first entry that is not over yet
+  lo=0;
+  hi=feedings;
+  while (lo<hi) {
+    i=(lo+hi)/2;
+    if (feeding_schedule[i].minute*60L+60+FEED_SLACK<=now)
+      lo=i+1;
+    else
+      hi=i;
+  }
+  for (i=0;i<feedings;i++,lo++) {
+    if (lo>=feedings)
+      lo=0;
+    t=feeding_schedule[lo].minute*60L-now-FEED_SLACK;
+    if (t<=-(60+2*FEED_SLACK))
+      t+=SECONDS_PER_DAY;
+    else if (t<=0) {
+      // skip if the clock already showed this minute done
+      if (feeding_schedule[lo].minute==checked)
+        continue;
+      t=0;
+    }
+    return t;
+  }
+  return SECONDS_PER_DAY;
 }
 
-// check if it is feeding time, return number
-// of servings to deliver. 0 means no feeding time
+// check if it is feeding time, the servings due from each hopper
+// are added to servings, at most 255. returns false if there is
+// nothing to feed. the entries of the same minute are fed together
 //
-uint8_t feeding_time(void)
+bool feeding_time(uint8_t *servings)
 {
-uint8_t i,h,m,s,Y,M,D,w;
+uint8_t i,j,h,m,s,Y,M,D,w,day;
+uint16_t now,k;
+bool due=false;
   clock.ReadDateTime(Y,M,D,h,m,s,w);
-  for (i=0;i<COUNTOF(feeding_schedule);i++) {
-    if (feeding_schedule[i].h==h && feeding_schedule[i].m==m && feeding_schedule[i].s) {
-      if (feeding_date[i]!=D)
+  now=h*60+m;
+  // a weekday out of range only matches the entries for every day
+  day=(w>=1 && w<=7)?1<<(w-1):0;
+  for (i=0;i<feedings && feeding_schedule[i].minute<=now;i++) {
+    if (feeding_schedule[i].minute==now) {
+      if (fault.kind && fault.day==D && fault.minute==now)
+        feeding_date[i]=D; // given up already, maybe before a reset
+      if (feeding_date[i]!=D && (feeding_schedule[i].days==ALLDAYS || (feeding_schedule[i].days&day)))
       {
         feeding_date[i]=D;
-        return feeding_schedule[i].s;
+        due_day=D;
+        due_minute=now;
+        for (j=0;j<HOPPERS;j++) {
+#if HOPPERS>1
+          if (feeding_schedule[i].hopper && feeding_schedule[i].hopper!=j+1)
+            continue;
+#endif
+          k=servings[j]+feeding_schedule[i].servings;
+          servings[j]=k>255?255:k; // many entries in the same minute
+        }
+        due=true;
       }
+      else
+        checked=now;
     }
   }
-  return 0;
+  return due;
 }
 
 // when this is called we are in low power mode
@@ -465,13 +1189,14 @@ uint8_t i,h,m,s,Y,M,D,w;
 //
 void do_processing(void)
 {
-uint8_t h,m,s;
-  // in powersave mode timers and everything else stops
-  // so the first thing to do is to read the clock
-  // to find out how long it has been
-  clock.ReadTime(h,m,s);
+  // in powersave mode timers and everything else stops,
+  // the time is kept by counting watchdog wakeups and
+  // taken from the clock every few minutes
+  if (timekeeper.Due())
+    timekeeper.Sync(clock.ReadDayTime());
 #ifdef RECHARGEABLE_BATTERY
   static uint8_t cm=99;
+  uint8_t m=(timekeeper.Now()/60)%60;
   // charge clock battery for one watchdog period every minute
   if (m!=cm) {
     clock.EnableCharging();
@@ -481,48 +1206,68 @@ uint8_t h,m,s;
     clock.DisableCharging();
   }
 #endif
-  // every 30 seconds check if it is feeding time
-  if (clock.SecondsPassed(scheduletimer)<30)
-    return;
-  scheduletimer=clock.ReadDayTime();
-  uint8_t servings=feeding_time();
-  if (servings) {
-    do_feeding(servings);
+  // the main loop only wakes up often when a feeding
+  // is near, check the clock if it is feeding time
+  if (next_feeding()==0) {
+    uint8_t servings[HOPPERS];
+    memset(servings,0,sizeof(servings));
+    if (feeding_time(servings)) {
+      record_fault(do_feeding(servings));
+    }
   }
-  // check for low battery
+  // every 30 seconds check for low battery
+  if (timekeeper.SecondsPassed(batterytimer)<30)
+    return;
+  batterytimer=timekeeper.Now();
   if (read_battery_voltage()<LOWBATTERYLEVEL) {
     // beep if low battery
-    player.Play("beep:o=7,b=64: 32a7");
+    player.Play(melody_beep);
+#ifdef RTTTL_MUTE
+    display.puts_P(PSTR("\rBAT"));
+    hold();
+#endif
   }
 }
 
 
 ISR(TIMER0_OVF_vect)
 {
-static uint8_t servoticks;
-uint16_t vv;
+static uint8_t ticks;
   // reset timer for next interrupt
   TCNT0=0xb0;
-  servoticks++;
+  if (!++ticks)
+    diag.Count(DIAG_TIMER);
+  timekeeper.Tick();
+  energy.Add(powermode==FULL?ENERGY_FULL:ENERGY_LOW);
+  if (PORTD&_BV(PD4))
+    energy.Add(ENERGY_SERVO);
+  if (TCCR1B)
+    energy.Add(ENERGY_SPEAKER);
+  if (player.Update())
+    diag.Count(DIAG_NOTES);
   if (powermode==FULL) {
     display.refresh();
-    if (servoticks>7) {
-      servo.Pulse();
-    }
+    if (display.Lit())
+      energy.Add(ENERGY_DISPLAY);
     // read buttons
     minus_button.Update((PINC & 0x02)>>1);
     plus_button.Update((PINC & 0x04)>>2);
     enter_button.Update(PIND & 1);
   }
-  if (servoticks>7)
-  {  
-    // read supply voltage
-    vv=ADCL;
-    vv|=(ADCH<<8);
-    ADCSRA=0xc3;  // start conversion again
+}
+
+// supply voltage conversions for battery_measure(), the first
+// ones after powering up are thrown away
+ISR(ADC_vect)
+{
+uint16_t vv;
+  vv=ADCL;
+  vv|=(ADCH<<8);
+  if (!adc_count)
+    return;
+  if (adc_count<=vcc.SAMPLES)
     vcc.Update(vv);
-    servoticks=0;
-  }
+  adc_count--;
 }
 
 // each watchdog interrupt shifts to low power mode
@@ -530,16 +1275,83 @@ uint16_t vv;
 //
 ISR(WDT_vect)
 {
+static uint16_t periods;
+  if (powermode==POWERSAVE) {
+    energy.Add(ENERGY_POWERSAVE,wakeperiods);
+    diag.Count(DIAG_WDT);
+    periods+=wakeperiods;
+    if (periods>=1800) { // an hour of 2 second periods
+      periods-=1800;
+      diag.Count(DIAG_SLEEP);
+    }
+    timekeeper.Sleep(wakeperiods);
+  }
   lowpower();  
 }
 
+// watchdog interrupt after given number of 2 second periods, 1 or 4.
+// the prescaler can only be changed with the timed sequence, the
+// watchdog is also restarted so that the period starts from now
+//
+void watchdog(uint8_t periods)
+{
+  wakeperiods=periods;
+  cli();
+  wdt_reset();
+  WDTCSR=(1<<WDE) | (1<<WDCE);
+  if (periods>1)
+    WDTCSR=(1<<WDE) | (1<<WDIE) | (1<<WDP3) | (1<<WDP0); // 8sec timeout, interrupt+reset
+  else
+    WDTCSR=(1<<WDE) | (1<<WDIE) | (1<<WDP2) | (1<<WDP1) | (1<<WDP0); // 2sec timeout, interrupt+reset
+  sei();
+}
+
+// servo frames and pulses, see Servo
+ISR(TIMER2_OVF_vect)
+{
+uint8_t h;
+  for (h=0;h<HOPPERS;h++) {
+    if (servo[h].Overflow())
+      diag.Count(DIAG_PULSES);
+  }
+}
+
+ISR(TIMER2_COMPB_vect)
+{
+  servo[0].Compare();
+}
+
+#if HOPPERS>1
+ISR(TIMER2_COMPA_vect)
+{
+  servo[1].Compare();
+}
+#endif
+
+// movement sensors, a rising edge stops the servo of the hopper
+// right away and records how many of its pulses were left
+ISR(PCINT0_vect)
+{
+uint8_t pins=PINB,rise,h;
+  rise=pins&~sensor_last&PCMSK0;
+  sensor_last=pins;
+  for (h=0;h<HOPPERS;h++) {
+    if ((rise&SENSOR_PIN(h)) && !(sensor_edge&_BV(h))) {
+      sensor_left[h]=servo[h].Stop();
+      sensor_edge|=_BV(h);
+    }
+  }
+}
+
 ISR(PCINT1_vect)
 {
+  diag.Count(DIAG_PCINT);
   lowpower();
 }
 
 ISR(PCINT2_vect)
 {
+  diag.Count(DIAG_PCINT);
   lowpower();
 }
 
@@ -573,16 +1385,36 @@ PB4 D2 cathode                        output       1    0
 PB5 D1 cathode                        output       1    0
 PB6 movement sensor input             input        0    0
 PB7 movement sensor power             output       1    0
+
+with HOPPERS 2 the second servo and sensor take pins from the above
+
+PB1 hopper 2 movement sensor input    input        0    0
+PB3 hopper 2 servo PWM                output       1    0
+PB7 D3 cathode                        output       1    0
+PD4 servo and movement sensor power   output       1    0
 */
 
 int main(void)
 {
+uint8_t h;
+  // energy and diagnostic counters survive watchdog resets,
+  // but not battery change
+  if (MCUSR&_BV(WDRF))
+    diag.Count(DIAG_RESETS);
+  else {
+    energy.Clear();
+    diag.Clear();
+  }
   MCUSR=0;
   MCUCR=0;
   // I/O directions
   DDRC=0x38;
   DDRD=0xfe;
+#if HOPPERS>1
+  DDRB=0xbd;
+#else
   DDRB=0xbf;
+#endif
   // initial state
   PORTC=0x06;
   PORTD=0x01;
@@ -594,34 +1426,41 @@ int main(void)
   PCMSK2=0x01; // mask out everything but button pins
   PCMSK1=0x06;
   // configure watchdog
-  WDTCSR=(1<<WDE) | (1<<WDCE);
-  WDTCSR=(1<<WDE) | (1<<WDIE) | (1<<WDP2) | (1<<WDP1) | (1<<WDP0) ; // 2sec timout, interrupt+reset
+  watchdog(1);
   // configure timer0 for periodic interrupts
   TCCR0B=4; // timer0 clock prescaler to 256
   TIMSK0=1; // enable overflow interrupts
   //
   DIDR0=1;
   ADMUX=0xc0;  // channel 0, internal 1.1V reference
-  ADCSRA=0xc3; // interrupts disabled, start conversion,  prescaler 8
-  while (ADCSRA&0x40) // wait until conversion completes
-    ;
+  ADCSRA=0;    // powered up for each measurement only
+  PRR|=_BV(PRADC);
 
   fullpower();
   // copy feeding schedule to RAM for faster access
   // to conserve power
   eeprom_read_block (&feeding_schedule,&ee_feeding_schedule,sizeof(feeding_schedule));
+  schedule_check();
+  schedule_sort();
+  eeprom_read_block(&fault,&ee_fault,sizeof(fault));
+  battery_calibrate();
+  for (h=0;h<HOPPERS;h++) {
+    pulses_per_tick[h]=eeprom_read_word(&ee_pulses[h]);
+    if (pulses_per_tick[h]<16 || pulses_per_tick[h]>32*16) // erased or garbage
+      pulses_per_tick[h]=PULSES_PER_TICK*16;
+  }
   //
   clock.EnsureRunning();
 #ifndef RECHARGEABLE_BATTERY
   clock.DisableCharging();
 #endif
   sei();
-  scheduletimer=clock.ReadDayTime();
+  timekeeper.Sync(clock.ReadDayTime(),false);
+  batterytimer=timekeeper.Now();
   while (1) {
     PCICR=0x06; // enable pin change interrupts 1 and 2
     sleep_cpu();   // watchdog or I/O interrupt wakes us up
-    wdt_reset();
-    WDTCSR=(1<<WDIE) | (1<<WDP2) | (1<<WDP1) | (1<<WDP0) ; // 2sec timout, interrupt+reset
+    watchdog(1); // short timeout while awake
     PCICR=0x00;
     // now check if it was button press or watchdog
     if ((PIND&1)==0 || (PINC&0x06)!=0x06) {
@@ -630,7 +1469,11 @@ int main(void)
     else {
       do_processing();
     }
+    player.Wait(); // timers stop in power down, let the melody finish
     powersave();   // preapare to take another nap
+    // sleep in 8 second periods until a feeding is near
+    int32_t t=next_feeding();
+    watchdog(t<0 || t>WAKE_LONG?4:1);
   }
 }
 
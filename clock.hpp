@@ -25,8 +25,15 @@ SOFTWARE.
 #define __clock_hpp__
 #include <avr/io.h>
 
+// called once for every transaction with the clock chip, the
+// application can define this to count them
+#ifndef clock_transaction
+#define clock_transaction()
+#endif
+
 class Clock
 {
+  uint8_t control,trickle; // last written values, 0xff when not known
 
   #define clk_low() (PORTC &= (~_BV(PC3)))
   #define clk_high() (PORTC |= _BV(PC3))
@@ -90,6 +97,7 @@ class Clock
 
   uint8_t read(uint8_t adr)
   {
+    clock_transaction();
     rst_high();
     send(adr);
     io_input();
@@ -100,8 +108,24 @@ class Clock
     return adr;
   }
 
+  // clock burst read of the first n registers in one transaction,
+  // the chip latches all of them at once so they are consistent
+  void burst(uint8_t *r,uint8_t n)
+  {
+    clock_transaction();
+    rst_high();
+    send(0xbf);
+    io_input();
+    clk_low();
+    while (n--)
+      *r++=recv();
+    rst_low();
+    io_output();
+  }
+
   void write(uint8_t adr,uint8_t d)
   {
+    clock_transaction();
     rst_high();
     send(adr);
     clk_low();
@@ -120,25 +144,42 @@ class Clock
     return ((bin/10)<<4)+(bin%10);
   }
 
+  // control and trickle charger registers are only written
+  // when the value changes
+  void protect(uint8_t wp)
+  {
+    if (wp!=control) {
+      write(0x8e,wp);
+      control=wp;
+    }
+  }
+
+  void charger(uint8_t v)
+  {
+    if (v!=trickle) {
+      protect(0); // enable writing
+      write(0x90,v);
+      trickle=v;
+    }
+  }
+
 public:
 
   void EnableCharging()
   {
-    write(0x8e,0); // enable writing
-    write(0x90,0xa5); // set trickle charge to 1 diode, 2kohm resistor
-    write(0x8e,0x80); // disable writing
+    charger(0xa5); // set trickle charge to 1 diode, 2kohm resistor
+    protect(0x80); // disable writing
   }
 
   void DisableCharging()
   {
-    write(0x8e,0);
-    write(0x90,0);
-    write(0x8e,0x80);
+    charger(0);
+    protect(0x80);
   }
     
   void ChangeDateTime(uint8_t Y,uint8_t M,uint8_t D,uint8_t h,uint8_t m,uint8_t s,uint8_t w)
   {
-    write(0x8e,0);
+    protect(0);
     write(0x80,tobcd(s));
     write(0x82,tobcd(m));
     write(0x84,tobcd(h)); // 24H format
@@ -146,11 +187,13 @@ public:
     write(0x88,tobcd(M));
     write(0x8a,tobcd(w));
     write(0x8c,tobcd(Y));
-    write(0x8e,0x80);
+    protect(0x80);
   }
 
   Clock()
   {
+    control=0xff;
+    trickle=0xff;
   }
 
   void EnsureRunning()
@@ -162,44 +205,46 @@ public:
 
   void SetHour(uint8_t h)
   {
-    write(0x8e,0);
+    protect(0);
     write(0x84,tobcd(h));
-    write(0x8e,0x80);
+    protect(0x80);
   }
 
   void SetMinute(uint8_t m)
   {
-    write(0x8e,0);
+    protect(0);
     write(0x82,tobcd(m));
-    write(0x8e,0x80);
+    protect(0x80);
   }
 
   // all values are BCD numbers  
   void ReadDateTime(uint8_t& Y,uint8_t& M,uint8_t& D,uint8_t& h,uint8_t& m,uint8_t& s,uint8_t& w)
   {
-    s=tobin(read(0x81)&0x7f);
-    m=tobin(read(0x83));
-    h=tobin(read(0x85)&0x3f);
-    D=tobin(read(0x87));
-    M=tobin(read(0x89));
-    w=tobin(read(0x8b));
-    Y=tobin(read(0x8d));
+    uint8_t r[7];
+    burst(r,7);
+    s=tobin(r[0]&0x7f);
+    m=tobin(r[1]);
+    h=tobin(r[2]&0x3f);
+    D=tobin(r[3]);
+    M=tobin(r[4]);
+    w=tobin(r[5]);
+    Y=tobin(r[6]);
   }
 
   void ReadTime(uint8_t& h,uint8_t& m,uint8_t& s)
   {
-    m=tobin(read(0x83));
-    h=tobin(read(0x85)&0x3f);
-    s=tobin(read(0x81)&0x7f);
+    uint8_t r[3];
+    burst(r,3);
+    s=tobin(r[0]&0x7f);
+    m=tobin(r[1]);
+    h=tobin(r[2]&0x3f);
   }
     
   // returns number of current second within current day
   int32_t ReadDayTime(void)
   {
     uint8_t h,m,s;
-    s=tobin(read(0x81)&0x7f);
-    m=tobin(read(0x83));
-    h=tobin(read(0x85)&0x3f);
+    ReadTime(h,m,s);
     return (h*60L*60L)+(m*60L)+s;
   }
 
@@ -0,0 +1,78 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __diag_hpp__
+#define __diag_hpp__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// DIAG_TIMER counts blocks of 256 timer0 interrupts, 0.66s awake, and
+// DIAG_SLEEP hours in power down, so that they last for years. the
+// rest count single events, DIAG_WDT the wakes from power down
+enum { DIAG_TIMER, DIAG_WDT, DIAG_PCINT, DIAG_RTC, DIAG_EEPROM, DIAG_PULSES,
+       DIAG_STEPFAIL, DIAG_NOTES, DIAG_RESETS, DIAG_ABORTS, DIAG_SLEEP,
+       DIAG_COUNTERS };
+
+// event counters that stop at their maximum instead of wrapping.
+// each counter must only be updated from one context, either an
+// interrupt handler or the main program. there is no constructor,
+// so that an instance placed in .noinit survives watchdog resets
+class Diag
+{
+  volatile uint16_t count[DIAG_COUNTERS];
+
+public:
+  void Clear(void)
+  {
+    uint8_t i;
+    for (i=0;i<DIAG_COUNTERS;i++)
+      count[i]=0;
+  }
+
+  void Count(uint8_t i)
+  {
+    if (count[i]!=0xffff)
+      count[i]++;
+  }
+
+  void Add(uint8_t i,uint16_t n)
+  {
+    if (count[i]>0xffff-n)
+      count[i]=0xffff;
+    else
+      count[i]+=n;
+  }
+
+  uint16_t Get(uint8_t i)
+  {
+    uint16_t v;
+    cli();
+    v=count[i];
+    sei();
+    return v;
+  }
+
+};
+
+#endif
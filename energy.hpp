@@ -0,0 +1,95 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __energy_hpp__
+#define __energy_hpp__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "flash.hpp"
+
+// length of one timer0 tick in microseconds and of the 2 second watchdog
+// period in milliseconds, these must match the setup in main()
+#ifndef ENERGY_TICK_US
+#define ENERGY_TICK_US 2560
+#endif
+#ifndef ENERGY_SLEEP_MS
+#define ENERGY_SLEEP_MS 2048
+#endif
+
+enum { ENERGY_FULL, ENERGY_LOW, ENERGY_POWERSAVE, ENERGY_SERVO,
+       ENERGY_SPEAKER, ENERGY_DISPLAY, ENERGY_BUCKETS };
+
+// time spent in each power mode and with each load switched on.
+// powersave is counted in 2 second watchdog periods, everything else in
+// timer ticks. there is no constructor, so that an instance placed
+// in .noinit survives watchdog resets, call Clear() on power up
+class Energy
+{
+  volatile uint32_t count[ENERGY_BUCKETS];
+
+public:
+  void Clear(void)
+  {
+    uint8_t i;
+    for (i=0;i<ENERGY_BUCKETS;i++)
+      count[i]=0;
+  }
+
+  // called from interrupt handlers only
+  void Add(uint8_t bucket,uint8_t n=1)
+  {
+    count[bucket]+=n;
+  }
+
+  uint32_t Seconds(uint8_t bucket)
+  {
+    uint32_t c;
+    cli();
+    c=count[bucket];
+    sei();
+    if (bucket==ENERGY_POWERSAVE)
+      return c*(ENERGY_SLEEP_MS/8)/125L;
+    return c*(ENERGY_TICK_US/10)/100000L;
+  }
+
+  // time since the counters were cleared
+  uint32_t Elapsed(void)
+  {
+    return Seconds(ENERGY_FULL)+Seconds(ENERGY_LOW)+Seconds(ENERGY_POWERSAVE);
+  }
+
+  // charge drawn in mAs, given a table in flash with supply current
+  // in uA for each bucket
+  uint32_t Charge(const uint32_t *ua)
+  {
+    uint32_t mas=0;
+    uint8_t i;
+    for (i=0;i<ENERGY_BUCKETS;i++)
+      mas+=Seconds(i)*flash_read(&ua[i])/1000L;
+    return mas;
+  }
+
+};
+
+#endif
@@ -0,0 +1,52 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __flash_hpp__
+#define __flash_hpp__
+
+#include <avr/pgmspace.h>
+
+// constant tables are kept in flash to save RAM. PROGMEM data can not
+// be read through plain pointers, these fetch one element of the types
+// the tables are made of
+static inline uint8_t flash_read(const uint8_t *p)
+{
+  return pgm_read_byte(p);
+}
+
+static inline char flash_read(const char *p)
+{
+  return pgm_read_byte(p);
+}
+
+static inline uint16_t flash_read(const uint16_t *p)
+{
+  return pgm_read_word(p);
+}
+
+static inline uint32_t flash_read(const uint32_t *p)
+{
+  return pgm_read_dword(p);
+}
+
+#endif
@@ -66,12 +66,21 @@ letters = {
   " ":""  
 }
 
-# now just create C code for bitmaps
+# now just create C code for bitmaps, a table indexed by the character
+# code from space to Z. lowercase forms are only used for letters that
+# have no uppercase form
+import sys
+
+glyphs = {}
 for c in sorted(letters.keys()):
-  print "{ '%c', "%c.upper(),
-  l=letters[c]
   cc=0
-  for bl in l:
-    b=bits[bl]
-    cc=cc+b
-  print "0x%02x },"%cc
+  for bl in letters[c]:
+    cc=cc+bits[bl]
+  if c.upper() not in glyphs:
+    glyphs[c.upper()]=cc
+
+sys.stdout.write("// generated by font.py, segment bits for characters ' ' to 'Z'\n")
+sys.stdout.write("static const uint8_t glyphs[] PROGMEM =\n{\n")
+for i in range(ord(' '),ord('Z')+1):
+  sys.stdout.write("  0x%02x, // '%c'\n"%(glyphs.get(chr(i),0),chr(i)))
+sys.stdout.write("};\n")
@@ -0,0 +1,86 @@
+// generated by rtttl.py, do not edit
+#ifndef __melodies_hpp__
+#define __melodies_hpp__
+
+#include <avr/pgmspace.h>
+
+#if F_CPU != 8000000UL
+#error melodies.hpp was generated for another F_CPU, run rtttl.py
+#endif
+
+// Beethoven - Fur Elise
+static const uint8_t melody_elise[] PROGMEM = {
+   73,0xd9,0x0b,
+   73,0x8d,0x0c,
+   73,0xd9,0x0b,
+   73,0x8d,0x0c,
+   73,0xd9,0x0b,
+   73,0xd1,0x0f,
+   73,0x4c,0x0d,
+   73,0xed,0x0e,
+   73,0xc0,0x11,
+   73,0x66,0x2f,
+   73,0x82,0x23,
+   73,0xdc,0x1d,
+   73,0xb2,0x17,
+   73,0xc0,0x11,
+   73,0xd1,0x0f,
+   73,0x66,0x2f,
+   73,0x9e,0x25,
+   73,0xb2,0x17,
+   73,0xcf,0x12,
+   73,0xd1,0x0f,
+   73,0xed,0x0e,
+   73,0x66,0x2f,
+   73,0x82,0x23,
+   73,0xb2,0x17,
+   73,0xd9,0x0b,
+   73,0x8d,0x0c,
+   73,0xd9,0x0b,
+   73,0x8d,0x0c,
+   73,0xd9,0x0b,
+   73,0xd1,0x0f,
+   73,0x4c,0x0d,
+   73,0xed,0x0e,
+   73,0xc0,0x11,
+   73,0x66,0x2f,
+   73,0x82,0x23,
+   73,0xdc,0x1d,
+   73,0xb2,0x17,
+   73,0xc0,0x11,
+   73,0xd1,0x0f,
+   73,0x66,0x2f,
+   73,0x9e,0x25,
+   73,0xb2,0x17,
+   73,0xed,0x0e,
+   73,0xd1,0x0f,
+  255,0xc0,0x11,
+   38,0xc0,0x91,
+  0
+};
+
+// beep
+static const uint8_t melody_beep[] PROGMEM = {
+   46,0xe0,0x08,
+  0
+};
+
+// alert
+static const uint8_t melody_alert[] PROGMEM = {
+   42,0xed,0x0e,
+   42,0x00,0x00,
+   42,0xed,0x13,
+   42,0x00,0x00,
+   42,0xed,0x0e,
+   42,0x00,0x00,
+   42,0xed,0x13,
+   42,0x00,0x00,
+   42,0xed,0x0e,
+   42,0x00,0x00,
+   42,0xed,0x13,
+   42,0x00,0x00,
+  167,0xed,0x0e,
+  0
+};
+
+#endif
@@ -0,0 +1,190 @@
+# MIT License
+#
+# Copyright (c) 2017 Madis Kaal
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# compiles RTTTL ringtones into the note streams played by rtttl.hpp,
+# so that the firmware does not have to parse text or divide at run time
+#
+#   python rtttl.py > melodies.hpp        generate the header
+#   python rtttl.py -w elise elise.wav    render a melody to a WAV file
+#
+# each note is three bytes: length in timer ticks and the OCR1A value,
+# low byte first. OCR1A value 0 is a pause, and bit 15 continues the
+# previous note without restarting the timer, for notes longer than
+# 255 ticks. zero length ends the melody
+#
+# RTTTL format, see the spec for details:
+#   <name> : [d=<duration>,o=<octave>,b=<bpm>] : <note>,<note>...
+#   <note> := [<duration>] <C|C#|D|...|B|H|P> [#] [.] [<octave>] [.]
+# durations are 1,2,4,8,16,32, octaves 5..8 where A5 is 440Hz, and the
+# defaults are d=4, o=6, b=63. the dot makes a note 1.5 times longer
+
+import sys
+import struct
+import wave
+
+F_CPU = 8000000  # must match the Makefile
+PRESCALER = 1    # timer1 prescaler set in rtttl.hpp
+TICK_US = 2560   # timer0 tick, Update() is called once per tick
+TIE = 0x8000
+
+melodies = [
+  ("elise", "Beethoven - Fur Elise : d=4,o=5,b=160:8e7,8d#7,8e7,8d#7,8e7,8b6,8d7,8c7,8a6,8e,8a,8c6,8e6,8a6,8b6,8e,8g#,8e6,8g#6,8b6,8c7,8e,8a,8e6,8e7,8d#7,8e7,8d#7,8e7,8b6,8d7,8c7,8a6,8e,8a,8c6,8e6,8a6,8b6,8e,8g#,8e6,8c7,8b6,2a6,"),
+  ("beep", "beep:o=7,b=64: 32a7"),
+  ("alert", "alert:d=16,o=6,b=140:c7,p,g,p,c7,p,g,p,c7,p,g,p,4c7"),
+]
+
+semitones = { "c":0, "d":2, "e":4, "f":5, "g":7, "a":9, "b":11, "h":11 }
+
+def frequency(name, octave):
+  # equal temperament, A5 is 440Hz
+  n = semitones[name[0]] + (1 if name.endswith("#") else 0)
+  return 440.0 * 2.0 ** ((octave - 5) + (n - 9) / 12.0)
+
+def number(s, i):
+  v = 0
+  while i < len(s) and s[i].isdigit():
+    v = v * 10 + int(s[i])
+    i += 1
+  return v, i
+
+def parse(text):
+  # returns list of (frequency or 0, milliseconds)
+  parts = text.split(":")
+  if len(parts) != 3:
+    raise ValueError("bad RTTTL: " + text)
+  duration, octave, bpm = 4, 6, 63
+  for d in parts[1].replace(" ", "").split(","):
+    if d.startswith("d="):
+      duration = int(d[2:])
+    elif d.startswith("o="):
+      octave = int(d[2:])
+    elif d.startswith("b="):
+      bpm = int(d[2:])
+  notes = []
+  for n in parts[2].replace(" ", "").lower().split(","):
+    if not n:
+      continue
+    i = 0
+    nd, i = number(n, i)
+    if not nd:
+      nd = duration
+    name = n[i]
+    i += 1
+    if i < len(n) and n[i] == "#":
+      name += "#"
+      i += 1
+    dotted = False
+    if i < len(n) and n[i] == ".":
+      dotted = True
+      i += 1
+    ns, i = number(n, i)
+    if not ns:
+      ns = octave
+    if i < len(n) and n[i] == ".":
+      dotted = True
+    ms = 60000.0 / bpm * 4 / nd
+    if dotted:
+      ms = ms * 1.5
+    if name == "p" or ns < 5 or ns > 8:
+      notes.append((0, ms))
+    else:
+      notes.append((frequency(name, ns), ms))
+  return notes
+
+def compile(text):
+  # returns list of (ticks, OCR1A value) entries
+  stream = []
+  for freq, ms in parse(text):
+    ticks = max(1, int(ms * 1000 / TICK_US + 0.5))
+    top = 0
+    if freq:
+      top = int(F_CPU / PRESCALER / 2.0 / freq + 0.5) - 1
+    flags = 0
+    while ticks:
+      n = min(ticks, 255)
+      stream.append((n, top | flags))
+      flags = TIE
+      ticks -= n
+  return stream
+
+def header():
+  out = []
+  out.append("// generated by rtttl.py, do not edit")
+  out.append("#ifndef __melodies_hpp__")
+  out.append("#define __melodies_hpp__")
+  out.append("")
+  out.append("#include <avr/pgmspace.h>")
+  out.append("")
+  out.append("#if F_CPU != %dUL" % F_CPU)
+  out.append("#error melodies.hpp was generated for another F_CPU, run rtttl.py")
+  out.append("#endif")
+  for name, text in melodies:
+    stream = compile(text)
+    out.append("")
+    out.append("// " + text.split(":")[0].strip())
+    out.append("static const uint8_t melody_%s[] PROGMEM = {" % name)
+    for ticks, top in stream:
+      out.append("  %3d,0x%02x,0x%02x," % (ticks, top & 0xff, top >> 8))
+    out.append("  0")
+    out.append("};")
+  out.append("")
+  out.append("#endif")
+  return "\n".join(out) + "\n"
+
+def render(text, filename, rate=22050):
+  # square wave at the frequency the timer really makes
+  w = wave.open(filename, "wb")
+  w.setnchannels(1)
+  w.setsampwidth(1)
+  w.setframerate(rate)
+  phase = 0.0
+  level = 0
+  data = bytearray()
+  for ticks, top in compile(text):
+    samples = int(ticks * TICK_US * rate / 1000000.0)
+    top &= ~TIE
+    if not top:
+      data.extend(bytearray([128]) * samples)
+      continue
+    freq = F_CPU / PRESCALER / 2.0 / (top + 1)
+    for i in range(samples):
+      phase += freq / rate
+      if phase >= 0.5:
+        phase -= 0.5
+        level ^= 1
+      data.append(192 if level else 64)
+  w.writeframes(bytes(data))
+  w.close()
+
+if len(sys.argv) == 4 and sys.argv[1] == "-w":
+  for name, text in melodies:
+    if name == sys.argv[2]:
+      render(text, sys.argv[3])
+      break
+  else:
+    sys.stderr.write("no melody %s\n" % sys.argv[2])
+    sys.exit(1)
+elif len(sys.argv) == 1:
+  sys.stdout.write(header())
+else:
+  sys.stderr.write("usage: rtttl.py [-w melody file.wav]\n")
+  sys.exit(1)
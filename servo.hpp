@@ -25,51 +25,185 @@ SOFTWARE.
 #define __servo_hpp__
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 #define servo_power_off() (PORTD&=(~_BV(PD4)))
 #define servo_power_on() (PORTD |= _BV(PD4))
 
-// Pulse() needs to be called every 20ms to run the servo
+// dispensers on the board. the first servo is on OC2B, a second one
+// on OC2A. both share timer2 and the servo power switch
+#ifndef HOPPERS
+#define HOPPERS 1
+#endif
+enum { SERVO_OC2B, SERVO_OC2A };
+
+// channels that have timer2 running for them
+static volatile uint8_t servo_running;
+
+// servo positions in 16us steps of timer2, full speed either way and
+// stopped. the pulse is one step longer than the position
+#define SERVO_LEFT 60
+#define SERVO_RIGHT 125
+#define SERVO_STOP 93
+
+// timer2 cycles of 4.096ms in a 20.48ms servo frame
+#define SERVO_CYCLES 5
+
+// a motion profile ramps the pulse width from the stop position to
+// full speed over the first frames of a move. moves that start from
+// rest or reverse the wheel draw less inrush current with a ramp.
+// there is no ramp down, a move ends on a sensor edge that comes at
+// no known pulse
+struct ServoProfile
+{
+  uint8_t up; // frames to reach full speed
+};
+
+static const ServoProfile servo_hard = { 0 };
+static const ServoProfile servo_soft = { 3 };
+
+// timer2 runs in fast PWM mode at clk/128 while a servo moves. the
+// output of the channel is connected for one cycle in a frame, so the
+// pulse width is made by the hardware no matter how late the interrupts
+// are. the output is connected in the compare interrupt of the cycle
+// before the pulse, after its own match, and disconnected again in the
+// compare interrupt that ends the pulse. Overflow() and Compare() are
+// called from the timer2 interrupts. each channel keeps its own frame,
+// a channel started while the other one runs pulses in another cycle
 //
 class Servo
 {
+uint8_t oc; // SERVO_OC2B or SERVO_OC2A
 volatile uint16_t pcount;
 volatile uint8_t active;
+volatile uint8_t cycle; // timer2 cycles into the frame
+volatile uint8_t armed; // 1 when the output is to be connected, 2 when connected
+uint8_t position,target,frame,up;
+uint8_t scale; // speed command, 1/128 units
+
+  uint8_t ocie(void) { return oc?_BV(OCIE2A):_BV(OCIE2B); }
+  uint8_t com(void) { return oc?_BV(COM2A1):_BV(COM2B1); }
+
+  // the channel is done, timer2 stops when the other one is too
+  void release(void)
+  {
+    servo_running&=~_BV(oc);
+    TIMSK2&=~ocie();
+    if (!servo_running) {
+      TCCR2B=0; // nothing to do until the next move
+      TIMSK2=0;
+    }
+  }
+
+  // set up the next pulse, called at the start of the cycle before it
+  bool arm(void)
+  {
+    if (!pcount) {
+      active=0;
+      release();
+      return false;
+    }
+    pcount--;
+    position=target;
+    if (frame<up) {
+      position=SERVO_STOP+((int16_t)target-SERVO_STOP)*(frame+1)/(up+1);
+      frame++;
+    }
+    if (oc)
+      OCR2A=position;
+    else
+      OCR2B=position;
+    TIFR2=oc?_BV(OCF2A):_BV(OCF2B);
+    TIMSK2|=ocie();
+    armed=1;
+    return true;
+  }
 
 public:
-  Servo()
+  Servo(uint8_t channel=SERVO_OC2B)
   {
+    oc=channel;
     TCCR2B=0;    // stop counter by disconnecting clock
-    TCNT2=0;     // start counting at bottom
-    OCR2A=0;     // set compare value to 0, this is where the counter resets
-    TCCR2A=0x33; // fast PWM mode 7, output on OC2B, set at compare match
-                 // clear at bottom
-    TCCR2B=0x0c;
-    OCR2B=255-120-1;
+    TCNT2=0;
+    TCCR2A=0x03; // fast PWM mode 3, outputs disconnected until a pulse
+    TIMSK2=0;
+    servo_running=0;
+    if (oc)
+      OCR2A=SERVO_STOP;
+    else
+      OCR2B=SERVO_STOP;
+    position=SERVO_STOP;
+    target=SERVO_LEFT;
+    scale=128;
+    cycle=0;
+    armed=0;
+    frame=0;
+    up=0;
     On();
   }
 
   uint8_t GetPosition(void)
   {
-    return 255-OCR2B-1;
+    return position;
   }
   
   void SetPosition(uint8_t pos)
   {
     On();
-    OCR2B=255-pos-1;
+    target=pos;
   }
 
-  void Left(uint16_t pulses)
+  void Left(uint16_t pulses,const ServoProfile& p=servo_hard)
   {
-    SetPosition(120);
-    pcount=pulses;
+    Move(SERVO_LEFT,pulses,p);
+  }
+
+  void Right(uint16_t pulses,const ServoProfile& p=servo_hard)
+  {
+    Move(SERVO_RIGHT,pulses,p);
+  }
+
+  // turn the speed command down, 128 is full speed
+  void Scale(uint8_t s)
+  {
+    scale=s;
   }
 
-  void Right(uint16_t pulses)
+  // a move that has no pulse on its way arms its first one at once.
+  // when the match of this cycle is over the output is connected right
+  // away and the pulse goes out in the next cycle, otherwise the match
+  // connects it as usual. a stopped timer, or one that only this
+  // channel uses, starts the next cycle one count before the bottom,
+  // so that the first pulse goes out without waiting
+  void Move(uint8_t pos,uint16_t pulses,const ServoProfile& p)
   {
-    SetPosition(250);
+    uint8_t match;
+    cli();
+    SetPosition(SERVO_STOP+((int16_t)pos-SERVO_STOP)*scale/128);
+    frame=0;
+    up=p.up;
     pcount=pulses;
+    servo_running|=_BV(oc);
+    if (!armed) {
+      match=oc?OCR2A:OCR2B; // the one of this cycle
+      if (!TCCR2B) {
+        TCNT2=0xff;
+        TIFR2=_BV(TOV2);
+        TIMSK2=_BV(TOIE2);
+      }
+      else if (servo_running==_BV(oc) && TCNT2>match) {
+        TCNT2=0xff;
+        TIFR2=_BV(TOV2);
+      }
+      cycle=0;
+      arm();
+      if (TCNT2>match) {
+        TCCR2A|=com(); // output set at the next bottom
+        armed=2;
+      }
+      TCCR2B=0x05; // clk/128
+    }
+    sei();
   }
   
   void On()
@@ -79,17 +213,46 @@ public:
     servo_power_on();
   }
   
-  void Off()
+  // stops the channel and leaves the power on
+  void Halt()
   {
-    servo_power_off();
+    cli();
+    pcount=0;
     active=0;
+    armed=0;
+    TCCR2A&=~com();
+    release();
+    sei();
+  }
+
+  // the power is shared, it goes off with the last channel
+  void Off()
+  {
+    Halt();
+    cli();
+    if (!servo_running)
+      servo_power_off();
+    sei();
   }
   
-  void Stop()
+  // returns the pulses that were still to go, a pulse that is
+  // already on its way still goes out
+  uint16_t Stop()
   {
+    uint16_t n=pcount;
     pcount=0;
     active=0;
-    TCNT2=OCR2B-1;
+    return n;
+  }
+
+  // pulses still to go
+  uint16_t Remaining()
+  {
+    uint16_t v;
+    cli();
+    v=pcount;
+    sei();
+    return v;
   }
 
   bool Active()
@@ -104,20 +267,33 @@ public:
   {
     if (!Active())
       return 0;
-    if (GetPosition()>180)
+    if (target>SERVO_STOP)
       return 1;
     return -1;
   }
       
-  void Pulse()
+  // timer2 overflow, returns true if a pulse was set up
+  bool Overflow()
   {
-    if (!pcount) {
-      active=0;
+    if (!(servo_running&_BV(oc)))
+      return false;
+    if (++cycle<SERVO_CYCLES)
+      return false;
+    cycle=0;
+    return arm();
+  }
+
+  // timer2 compare match, the pulse of this cycle is over
+  void Compare()
+  {
+    if (armed==1) {
+      TCCR2A|=com(); // output set at the next bottom
+      armed=2;
     }
-    else
-    {
-      pcount--;
-      TCNT2=OCR2B-1;
+    else {
+      TCCR2A&=~com();
+      TIMSK2&=~ocie();
+      armed=0;
     }
   }
   
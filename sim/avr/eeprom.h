@@ -0,0 +1,85 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __sim_avr_eeprom_h__
+#define __sim_avr_eeprom_h__
+
+// host replacement for avr-libc <avr/eeprom.h>
+// EEMEM variables are ordinary host variables, the accessors only
+// charge the simulated device for the access time
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EEMEM
+
+void sim_eeprom_read(void *dst,const void *src,size_t n);
+void sim_eeprom_write(void *dst,const void *src,size_t n);
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p)
+{
+  uint8_t v;
+  sim_eeprom_read(&v,p,sizeof(v));
+  return v;
+}
+
+static inline uint16_t eeprom_read_word(const uint16_t *p)
+{
+  uint16_t v;
+  sim_eeprom_read(&v,p,sizeof(v));
+  return v;
+}
+
+static inline void eeprom_read_block(void *dst,const void *src,size_t n)
+{
+  sim_eeprom_read(dst,src,n);
+}
+
+static inline void eeprom_write_byte(uint8_t *p,uint8_t v)
+{
+  sim_eeprom_write(p,&v,sizeof(v));
+}
+
+static inline void eeprom_write_word(uint16_t *p,uint16_t v)
+{
+  sim_eeprom_write(p,&v,sizeof(v));
+}
+
+static inline void eeprom_write_block(const void *src,void *dst,size_t n)
+{
+  sim_eeprom_write(dst,src,n);
+}
+
+static inline void eeprom_update_byte(uint8_t *p,uint8_t v)
+{
+  if (eeprom_read_byte(p)!=v)
+    eeprom_write_byte(p,v);
+}
+
+static inline void eeprom_update_word(uint16_t *p,uint16_t v)
+{
+  if (eeprom_read_word(p)!=v)
+    eeprom_write_word(p,v);
+}
+
+#endif
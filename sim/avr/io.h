@@ -0,0 +1,202 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __sim_avr_io_h__
+#define __sim_avr_io_h__
+
+// host replacement for avr-libc <avr/io.h>
+//
+// every I/O register is an empty object that forwards reads and writes
+// to the simulated device in sim.cpp, so the firmware sources compile
+// unchanged and the device model sees every access in program order
+
+#include <stdint.h>
+
+enum {
+  R_PINB,R_DDRB,R_PORTB,
+  R_PINC,R_DDRC,R_PORTC,
+  R_PIND,R_DDRD,R_PORTD,
+  R_TCCR0A,R_TCCR0B,R_TCNT0,R_OCR0A,R_OCR0B,R_TIMSK0,R_TIFR0,
+  R_TCCR1A,R_TCCR1B,R_TCCR1C,R_TCNT1,R_OCR1A,R_OCR1B,R_ICR1,R_TIMSK1,R_TIFR1,
+  R_TCCR2A,R_TCCR2B,R_TCNT2,R_OCR2A,R_OCR2B,R_TIMSK2,R_TIFR2,R_ASSR,
+  R_ADCL,R_ADCH,R_ADCSRA,R_ADCSRB,R_ADMUX,R_DIDR0,
+  R_PCICR,R_PCIFR,R_PCMSK0,R_PCMSK1,R_PCMSK2,
+  R_WDTCSR,R_MCUSR,R_MCUCR,R_SMCR,R_PRR,
+  R_GPIOR0,R_GPIOR1,R_GPIOR2,
+  R_COUNT
+};
+
+uint16_t sim_read(uint8_t reg);
+void sim_write(uint8_t reg,uint16_t value);
+
+template <uint8_t R,typename T=uint8_t>
+struct SimRegister
+{
+  operator T() const { return (T)sim_read(R); }
+  SimRegister& operator=(T v) { sim_write(R,v); return *this; }
+  SimRegister& operator=(const SimRegister& r) { sim_write(R,(T)r); return *this; }
+  SimRegister& operator|=(T v) { sim_write(R,(T)(sim_read(R)|v)); return *this; }
+  SimRegister& operator&=(T v) { sim_write(R,(T)(sim_read(R)&v)); return *this; }
+  SimRegister& operator^=(T v) { sim_write(R,(T)(sim_read(R)^v)); return *this; }
+};
+
+#define SIM_REG(name) static SimRegister<R_##name> name __attribute__((unused))
+#define SIM_REG16(name) static SimRegister<R_##name,uint16_t> name __attribute__((unused))
+
+SIM_REG(PINB); SIM_REG(DDRB); SIM_REG(PORTB);
+SIM_REG(PINC); SIM_REG(DDRC); SIM_REG(PORTC);
+SIM_REG(PIND); SIM_REG(DDRD); SIM_REG(PORTD);
+SIM_REG(TCCR0A); SIM_REG(TCCR0B); SIM_REG(TCNT0); SIM_REG(OCR0A);
+SIM_REG(OCR0B); SIM_REG(TIMSK0); SIM_REG(TIFR0);
+SIM_REG(TCCR1A); SIM_REG(TCCR1B); SIM_REG(TCCR1C); SIM_REG16(TCNT1);
+SIM_REG16(OCR1A); SIM_REG16(OCR1B); SIM_REG16(ICR1); SIM_REG(TIMSK1);
+SIM_REG(TIFR1);
+SIM_REG(TCCR2A); SIM_REG(TCCR2B); SIM_REG(TCNT2); SIM_REG(OCR2A);
+SIM_REG(OCR2B); SIM_REG(TIMSK2); SIM_REG(TIFR2); SIM_REG(ASSR);
+SIM_REG(ADCL); SIM_REG(ADCH); SIM_REG(ADCSRA); SIM_REG(ADCSRB);
+SIM_REG(ADMUX); SIM_REG(DIDR0);
+SIM_REG(PCICR); SIM_REG(PCIFR); SIM_REG(PCMSK0); SIM_REG(PCMSK1);
+SIM_REG(PCMSK2);
+SIM_REG(WDTCSR); SIM_REG(MCUSR); SIM_REG(MCUCR); SIM_REG(SMCR); SIM_REG(PRR);
+SIM_REG(GPIOR0); SIM_REG(GPIOR1); SIM_REG(GPIOR2);
+
+#define _BV(bit) (1<<(bit))
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// WDTCSR
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDE 3
+#define WDCE 4
+#define WDP3 5
+#define WDIE 6
+#define WDIF 7
+
+// MCUSR
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+
+// TCCR2A
+#define WGM20 0
+#define WGM21 1
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+
+// TIMSKn / TIFRn
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+
+// ADCSRA
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+
+// PCICR / PCIFR
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+
+// PRR
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI 7
+
+// SMCR
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+
+// interrupt vectors, the simulator calls these by name
+#define PCINT0_vect sim_vect_PCINT0
+#define PCINT1_vect sim_vect_PCINT1
+#define PCINT2_vect sim_vect_PCINT2
+#define WDT_vect sim_vect_WDT
+#define TIMER2_COMPA_vect sim_vect_TIMER2_COMPA
+#define TIMER2_COMPB_vect sim_vect_TIMER2_COMPB
+#define TIMER2_OVF_vect sim_vect_TIMER2_OVF
+#define TIMER1_COMPA_vect sim_vect_TIMER1_COMPA
+#define TIMER1_COMPB_vect sim_vect_TIMER1_COMPB
+#define TIMER1_OVF_vect sim_vect_TIMER1_OVF
+#define TIMER0_COMPA_vect sim_vect_TIMER0_COMPA
+#define TIMER0_COMPB_vect sim_vect_TIMER0_COMPB
+#define TIMER0_OVF_vect sim_vect_TIMER0_OVF
+#define ADC_vect sim_vect_ADC
+
+#endif
@@ -0,0 +1,66 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __sim_avr_pgmspace_h__
+#define __sim_avr_pgmspace_h__
+
+// host replacement for avr-libc <avr/pgmspace.h>
+// flash is ordinary host memory, reads are charged the LPM cycles
+
+#include <stdint.h>
+#include <string.h>
+
+void sim_busy(uint64_t cycles);
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+static inline uint8_t pgm_read_byte(const void *p)
+{
+  sim_busy(3);
+  return *(const uint8_t *)p;
+}
+
+static inline uint16_t pgm_read_word(const void *p)
+{
+  uint16_t v;
+  sim_busy(6);
+  memcpy(&v,p,sizeof(v));
+  return v;
+}
+
+static inline uint32_t pgm_read_dword(const void *p)
+{
+  uint32_t v;
+  sim_busy(12);
+  memcpy(&v,p,sizeof(v));
+  return v;
+}
+
+static inline void *memcpy_P(void *dst,const void *src,size_t n)
+{
+  sim_busy(3*n);
+  return memcpy(dst,src,n);
+}
+
+#endif
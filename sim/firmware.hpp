@@ -0,0 +1,73 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __sim_firmware_hpp__
+#define __sim_firmware_hpp__
+
+// the firmware is compiled into the same translation unit as each
+// simulator tool, so that the tools can reach its globals directly
+
+#include <string.h>
+#include <new>
+
+#define main firmware_main
+#include "../catfeeder.cpp"
+#undef main
+
+// a reset clears the RAM and runs the static constructors again.
+// static variables inside functions keep their values
+extern "C" void sim_firmware_reset(void)
+{
+  memset(feeding_schedule,0,sizeof(feeding_schedule));
+  memset(feeding_date,0,sizeof(feeding_date));
+  feedings=0;
+  batterytimer=0;
+  wakeperiods=1;
+  checked=-1;
+  memset(pulses_per_tick,0,sizeof(pulses_per_tick));
+  dispense_rate=0;
+  servo_speed=128;
+  sensor_edge=0;
+  sensor_last=0;
+  memset((void*)sensor_left,0,sizeof(sensor_left));
+  memset(hopper,0,sizeof(hopper));
+  due_day=0;
+  due_minute=0;
+  memset(&fault,0,sizeof(fault));
+  menutimer=0;
+  battery_scale=0;
+  adc_count=0;
+  powermode=FULL;
+  for (uint8_t h=0;h<HOPPERS;h++)
+    new (&servo[h]) Servo(h?SERVO_OC2A:SERVO_OC2B);
+  new (&clock) Clock;
+  new (&timekeeper) TimeKeeper;
+  new (&display) Display;
+  new (&minus_button) Button(1);
+  new (&plus_button) Button(1);
+  new (&enter_button) Button;
+  new (&vcc) Avalue<VCC_SHIFT,AVALUE_TRIM>;
+  new (&player) RTTTL;
+}
+
+#endif
@@ -0,0 +1,368 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "sim.hpp"
+#include "firmware.hpp"
+
+// Monte Carlo battery life estimate for a fleet of feeders
+//
+// every instance is a separate process forked from the pristine parent,
+// so each one starts the firmware from reset. an instance gets its own
+// feeding schedule, button usage, jam rate and battery, and runs the
+// firmware at a number of points along the battery discharge curve.
+// the charge drawn per day at each point gives the number of days the
+// battery lasts over that part of the curve
+//
+// usage: catfeeder_fleet [-n instances] [-j jobs] [-d days] [-k points]
+//                        [-e entries] [-b presses] [-r jamrate]
+//                        [-c mAh] [-x cutoff mV] [-s seed] [-v]
+//
+// -d is the number of days simulated at each point of the curve,
+// -e the number of schedule entries, -b the average number of menu
+// sessions per day. compile time settings like SERVINGSIZE and
+// LOWBATTERYLEVEL are given to make, see the Makefile
+
+#define MAXPOINTS 16
+#define MAXPRESSES 16
+#define DAY (86400*SIM_SECOND)
+
+struct Result
+{
+  double days;                   // estimated battery life
+  double mv[MAXPOINTS];          // open circuit voltage at each point
+  double mah[MAXPOINTS];         // charge drawn per day at each point
+  uint32_t resets;
+};
+
+// fleet settings
+static uint32_t instances=100;
+static uint32_t jobs;
+static double days=1.0;
+static uint8_t points=6;
+static uint8_t entries=3;
+static double presses=1.0;
+static double jamrate=0.002;
+static double capacity=2000.0;
+static double cutoff=4000.0;
+static uint32_t seed=1;
+static uint8_t verbose;
+
+// 4 NiMH cells, open circuit voltage against depth of discharge
+static const double curve_dod[] = { 0.0, 0.05, 0.2, 0.5, 0.8, 0.9, 0.95, 1.0 };
+static const double curve_mv[] = { 5600, 5200, 5000, 4880, 4720, 4480, 4200, 3800 };
+
+// one instance, lives in the child process
+static struct {
+  double scale;      // cell voltage spread
+  double capacity;   // mAh
+  double selfdis;    // self discharge, fraction of capacity per day
+  double dod_end;    // depth of discharge at cutoff voltage
+  double charge;     // mAs drawn at start of current point
+  uint8_t point;
+} unit;
+static Result result;
+static uint32_t rnd;
+
+static double random01(void)
+{
+  rnd=rnd*1103515245+12345;
+  return ((rnd>>8)&0xffffff)/(double)0x1000000;
+}
+
+static double uniform(double a,double b)
+{
+  return a+(b-a)*random01();
+}
+
+// number of events in a day for given average
+static uint8_t poisson(double mean)
+{
+double l=exp(-mean),p=1.0;
+uint8_t k=0;
+  do {
+    k++;
+    p*=random01();
+  } while (p>l && k<MAXPRESSES+1);
+  return k-1;
+}
+
+static double battery_mv(double dod)
+{
+uint8_t i;
+  for (i=1;i<COUNTOF(curve_dod)-1 && dod>curve_dod[i];i++);
+  return unit.scale*(curve_mv[i-1]+(curve_mv[i]-curve_mv[i-1])*
+    (dod-curve_dod[i-1])/(curve_dod[i]-curve_dod[i-1]));
+}
+
+// depth of discharge where the battery voltage falls to cutoff
+static double battery_end(void)
+{
+double lo=0.0,hi=1.0;
+uint8_t i;
+  if (battery_mv(hi)>=cutoff)
+    return hi;
+  for (i=0;i<32;i++) {
+    double mid=(lo+hi)/2;
+    if (battery_mv(mid)>=cutoff)
+      lo=mid;
+    else
+      hi=mid;
+  }
+  return lo;
+}
+
+static void release(void *arg)
+{
+  sim_button((uintptr_t)arg,0);
+}
+
+static void press(void *arg)
+{
+  sim_button((uintptr_t)arg,1);
+  sim_at(sim_now()+uniform(100,400)*SIM_MS,release,arg);
+}
+
+// button presses are scheduled a day at a time to keep the
+// simulator event queue short
+static void midnight(void *)
+{
+uint8_t i,n;
+  n=poisson(presses);
+  for (i=0;i<n;i++)
+    sim_at(sim_now()+(uint64_t)(random01()*DAY),press,(void*)(uintptr_t)(random01()*SIM_BUTTONS));
+  sim_at(sim_now()+DAY,midnight,0);
+}
+
+// start of a new point on the discharge curve
+static void point(void *)
+{
+  if (unit.point) {
+    double mah=(sim_stats.charge-unit.charge)/3600.0/days;
+    result.mah[unit.point-1]=mah+unit.selfdis*unit.capacity;
+  }
+  unit.charge=sim_stats.charge;
+  if (unit.point<points) {
+    double dod=unit.dod_end*(unit.point+0.5)/points;
+    result.mv[unit.point]=battery_mv(dod);
+    sim_battery((uint16_t)result.mv[unit.point]);
+    sim_at(sim_now()+(uint64_t)(days*DAY),point,0);
+  }
+  unit.point++;
+}
+
+static void instance(uint32_t n)
+{
+uint8_t i;
+  rnd=seed*2654435761u+n*40503u+1;
+  unit.scale=uniform(0.98,1.02);
+  unit.capacity=capacity*uniform(0.8,1.05);
+  unit.selfdis=uniform(0.0003,0.0015); // low self discharge cells
+  unit.dod_end=battery_end();
+  sim_mech.esr=uniform(0.15,0.5);
+  for (i=0;i<HOPPERS;i++)
+    sim_mech.jam_rate[i]=jamrate*uniform(0.0,2.0);
+  sim_mech.wdt_drift=uniform(-0.05,0.05);
+  sim_mech.seed=rnd;
+  // random feeding times, servings between 3 and 8
+  for (i=0;i<COUNTOF(ee_feeding_schedule);i++) {
+    ee_feeding_schedule[i].minute=0;
+    ee_feeding_schedule[i].servings=0;
+    ee_feeding_schedule[i].days=ALLDAYS;
+    if (i<entries) {
+      ee_feeding_schedule[i].minute=uniform(0,24*60);
+      ee_feeding_schedule[i].servings=uniform(3,9);
+    }
+  }
+  sim_rtc_set(17,1,1,0,0,0,7);
+  point(0);
+  midnight(0);
+  sim_run(firmware_main,(uint64_t)(points*days*DAY));
+  point(0);
+  result.days=0;
+  for (i=0;i<points;i++)
+    result.days+=unit.capacity*unit.dod_end/points/result.mah[i];
+  result.resets=sim_stats.resets;
+}
+
+static int compare(const void *a,const void *b)
+{
+double x=*(const double*)a,y=*(const double*)b;
+  return x<y?-1:x>y;
+}
+
+static void report(Result *r,uint32_t n)
+{
+double *life=(double*)malloc(n*sizeof(double));
+double sum=0,sq=0,mah[MAXPOINTS]={0},mv[MAXPOINTS]={0},width;
+uint32_t i,j,bins[10]={0},most=0,resets=0;
+  for (i=0;i<n;i++) {
+    life[i]=r[i].days;
+    sum+=life[i];
+    sq+=life[i]*life[i];
+    resets+=r[i].resets;
+    for (j=0;j<points;j++) {
+      mv[j]+=r[i].mv[j]/n;
+      mah[j]+=r[i].mah[j]/n;
+    }
+  }
+  qsort(life,n,sizeof(double),compare);
+  printf("instances           %u\n",n);
+  printf("schedule entries    %u\n",entries);
+  printf("serving size        %u\n",SERVINGSIZE);
+  printf("low battery level   %u mV\n",LOWBATTERYLEVEL*10);
+  printf("resets              %u\n",resets);
+  printf("\nbattery mV  charge mAh/day\n");
+  for (j=0;j<points;j++)
+    printf("%10.0f %15.3f\n",mv[j],mah[j]);
+  printf("\nlife days mean      %.1f\n",sum/n);
+  printf("          stddev    %.1f\n",sqrt(fmax(0.0,sq/n-(sum/n)*(sum/n))));
+  printf("          min       %.1f\n",life[0]);
+  printf("          5%%        %.1f\n",life[n*5/100]);
+  printf("          50%%       %.1f\n",life[n/2]);
+  printf("          95%%       %.1f\n",life[n*95/100]);
+  printf("          max       %.1f\n",life[n-1]);
+  width=(life[n-1]-life[0])/COUNTOF(bins);
+  if (width>0) {
+    printf("\n");
+    for (i=0;i<n;i++) {
+      j=(life[i]-life[0])/width;
+      if (j>=COUNTOF(bins))
+        j=COUNTOF(bins)-1;
+      if (++bins[j]>most)
+        most=bins[j];
+    }
+    for (j=0;j<COUNTOF(bins);j++)
+      printf("%7.1f %5u %.*s\n",life[0]+j*width,bins[j],
+        (int)(bins[j]*50/most),"##################################################");
+  }
+  free(life);
+}
+
+int main(int argc,char *argv[])
+{
+Result *results;
+pid_t *pids;
+int *fds;
+uint32_t next=0,done=0,i;
+int c,fd[2],status;
+pid_t pid;
+  jobs=sysconf(_SC_NPROCESSORS_ONLN);
+  while ((c=getopt(argc,argv,"n:j:d:k:e:b:r:c:x:s:v"))!=-1) {
+    switch (c) {
+      case 'n':
+        instances=atoi(optarg);
+        break;
+      case 'j':
+        jobs=atoi(optarg);
+        break;
+      case 'd':
+        days=atof(optarg);
+        break;
+      case 'k':
+        points=atoi(optarg);
+        break;
+      case 'e':
+        entries=atoi(optarg);
+        break;
+      case 'b':
+        presses=atof(optarg);
+        break;
+      case 'r':
+        jamrate=atof(optarg);
+        break;
+      case 'c':
+        capacity=atof(optarg);
+        break;
+      case 'x':
+        cutoff=atof(optarg);
+        break;
+      case 's':
+        seed=atoi(optarg);
+        break;
+      case 'v':
+        verbose=1;
+        break;
+      default:
+        fprintf(stderr,"usage: %s [-n instances] [-j jobs] [-d days] [-k points] [-e entries]\n"
+          "       [-b presses] [-r jamrate] [-c mAh] [-x cutoff mV] [-s seed] [-v]\n",argv[0]);
+        return 1;
+    }
+  }
+  if (!instances || !jobs || days<=0 || !points || points>MAXPOINTS ||
+      entries>COUNTOF(ee_feeding_schedule)) {
+    fprintf(stderr,"bad arguments\n");
+    return 1;
+  }
+  results=(Result*)calloc(instances,sizeof(Result));
+  pids=(pid_t*)calloc(instances,sizeof(pid_t));
+  fds=(int*)calloc(instances,sizeof(int));
+  // results are smaller than a pipe buffer, so the children never
+  // block on writing and can be collected in any order
+  while (done<instances) {
+    if (next<instances && next-done<jobs) {
+      if (pipe(fd)) {
+        perror("pipe");
+        return 1;
+      }
+      pid=fork();
+      if (pid<0) {
+        perror("fork");
+        return 1;
+      }
+      if (!pid) {
+        close(fd[0]);
+        instance(next);
+        if (write(fd[1],&result,sizeof(result))!=sizeof(result))
+          _exit(1);
+        _exit(0);
+      }
+      close(fd[1]);
+      pids[next]=pid;
+      fds[next]=fd[0];
+      next++;
+      continue;
+    }
+    pid=wait(&status);
+    for (i=0;i<next && pids[i]!=pid;i++);
+    if (i==next)
+      continue;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) ||
+        read(fds[i],&results[i],sizeof(Result))!=sizeof(Result)) {
+      fprintf(stderr,"instance %u failed\n",i);
+      return 1;
+    }
+    close(fds[i]);
+    pids[i]=0;
+    done++;
+    if (verbose)
+      fprintf(stderr,"instance %u: %.1f days\n",i,results[i].days);
+  }
+  report(results,instances);
+  return 0;
+}
@@ -0,0 +1,470 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim.hpp"
+#include "firmware.hpp"
+
+// replays a scripted scenario against the firmware and reports where
+// the time went, optionally comparing the result to a saved baseline
+//
+// usage: catfeeder_replay [-b baseline] [-t tolerance %] scenario
+//
+// a scenario has one event per line, # starts a comment. time is either
+// h:mm:ss[.mmm] from the start of the replay or +seconds after the
+// previous event
+//
+//   0:00:00 rtc 17-01-01 06:59:30 7   set the clock, last is day of week
+//   0:00:05 press enter [ms]          press minus, plus or enter
+//   +1.5    sensor 0 [hopper]         force movement sensor output 0 or 1
+//   +3      sensor auto [hopper]      let the wheel drive it again
+//   0:10:00 battery 4300 [seconds]    set battery mV, or ramp to it
+//   0:20:00 jam 0.01 [hopper]         wheel jam rate
+//   0:20:00 empty 1 [hopper]          hopper empty or not
+//   0:00:00 feed 12:01 3 [56]         schedule entry in eeprom, time,
+//                                     servings and clock weekdays.
+//                                     only at time zero, the first one
+//                                     replaces the default schedule
+//   0:00:00 erase                     schedule eeprom reads as erased,
+//                                     only at time zero, before feeds
+//   1:00:00 end                       end of the replay
+//
+// hoppers are numbered from 1, without one the event is for all of them.
+// the latency of a press is the time until the display shows something
+// else than it did when the button went down. held counts the images
+// that stayed lit on the display for HELD or longer
+
+#define MAXEVENTS 256
+#define MAXLINE 128
+#define HELD (2*SIM_SECOND)
+#define DARK (SIM_SECOND/100) // unlit this long ends an image
+
+enum { EV_RTC, EV_PRESS, EV_SENSOR, EV_BATTERY, EV_JAM, EV_EMPTY, EV_FEED, EV_ERASE,
+       EV_END };
+
+struct Event
+{
+  uint64_t when;
+  uint8_t type;
+  uint8_t arg[7];
+  double value;
+  double span;
+};
+
+static Event events[MAXEVENTS];
+static uint16_t nevents,next;
+static uint8_t feeds; // schedule entries written by feed events
+static uint8_t erased;
+
+// battery voltage ramp
+static double ramp_from,ramp_to;
+static uint64_t ramp_start,ramp_end;
+
+// firmware state followed through register writes
+static int8_t mode=-1;
+static uint64_t mode_since,mode_time[3];
+static uint64_t pressed_at;
+static uint32_t shown;
+static uint8_t waiting;
+static uint32_t presses,answered;
+static uint64_t latency_sum,latency_max;
+static uint32_t held_image,held;
+static uint64_t held_since,lit_cycles,lit_at;
+static uint8_t held_counted;
+
+static double ms(uint64_t cycles)
+{
+  return cycles*1000.0/SIM_SECOND;
+}
+
+static void probe(void)
+{
+  uint64_t t=sim_now();
+  if (powermode!=mode) {
+    if (mode>=0)
+      mode_time[mode]+=t-mode_since;
+    mode=powermode;
+    mode_since=t;
+  }
+  if (waiting && sim_display()!=shown) {
+    waiting=0;
+    answered++;
+    latency_sum+=t-pressed_at;
+    if (t-pressed_at>latency_max)
+      latency_max=t-pressed_at;
+  }
+  if (sim_display()!=held_image || t-lit_at>DARK) {
+    held_image=sim_display();
+    held_since=t;
+    held_counted=0;
+  }
+  else if (!held_counted && t-held_since>=HELD) {
+    held_counted=1;
+    held++;
+  }
+  if (sim_stats.display_on!=lit_cycles) {
+    lit_cycles=sim_stats.display_on;
+    lit_at=t;
+  }
+}
+
+static void release(void *arg)
+{
+  sim_button((uintptr_t)arg,0);
+}
+
+static void ramp(void *)
+{
+  uint64_t t=sim_now();
+  if (t>=ramp_end) {
+    sim_battery(ramp_to);
+    return;
+  }
+  sim_battery(ramp_from+(ramp_to-ramp_from)*(t-ramp_start)/(ramp_end-ramp_start));
+  sim_at(t+SIM_SECOND,ramp,0);
+}
+
+static void run(Event& e)
+{
+  uint8_t h;
+  switch (e.type) {
+    case EV_RTC:
+      sim_rtc_set(e.arg[0],e.arg[1],e.arg[2],e.arg[3],e.arg[4],e.arg[5],e.arg[6]);
+      break;
+    case EV_PRESS:
+      presses++;
+      pressed_at=sim_now();
+      shown=sim_display();
+      waiting=1;
+      sim_button(e.arg[0],1);
+      sim_at(sim_now()+(uint64_t)(e.value*SIM_MS),release,(void*)(uintptr_t)e.arg[0]);
+      break;
+    case EV_SENSOR:
+      for (h=0;h<HOPPERS;h++)
+        if (!e.arg[0] || e.arg[0]==h+1)
+          sim_sensor(h,e.value);
+      break;
+    case EV_BATTERY:
+      if (e.span>0) {
+        ramp_from=sim_battery();
+        ramp_to=e.value;
+        ramp_start=sim_now();
+        ramp_end=ramp_start+(uint64_t)(e.span*SIM_SECOND);
+        ramp(0);
+      }
+      else
+        sim_battery(e.value);
+      break;
+    case EV_JAM:
+      for (h=0;h<HOPPERS;h++)
+        if (!e.arg[0] || e.arg[0]==h+1)
+          sim_mech.jam_rate[h]=e.value;
+      break;
+    case EV_EMPTY:
+      for (h=0;h<HOPPERS;h++)
+        if (!e.arg[0] || e.arg[0]==h+1)
+          sim_mech.empty[h]=e.value;
+      break;
+    case EV_FEED:
+      if (!feeds && !erased)
+        memset(ee_feeding_schedule,0,sizeof(ee_feeding_schedule));
+      ee_feeding_schedule[feeds].minute=e.arg[0]*60+e.arg[1];
+      ee_feeding_schedule[feeds].servings=e.arg[2];
+      ee_feeding_schedule[feeds].days=e.arg[3];
+#if HOPPERS>1
+      ee_feeding_schedule[feeds].hopper=0;
+#endif
+      feeds++;
+      break;
+    case EV_ERASE:
+      memset(ee_feeding_schedule,0xff,sizeof(ee_feeding_schedule));
+      erased=1;
+      break;
+  }
+}
+
+// events are fed to the simulator one at a time, its queue is short
+static void dispatch(void *)
+{
+  while (next<nevents && events[next].when<=sim_now())
+    run(events[next++]);
+  if (next<nevents)
+    sim_at(events[next].when,dispatch,0);
+}
+
+static int parse(const char *name)
+{
+  FILE *f=fopen(name,"r");
+  char line[MAXLINE],time[32],cmd[32],a[32],b[32];
+  unsigned h,m,Y,M,D,w,hh,mm,ss;
+  double s,prev=0;
+  int n,lineno=0,nfeed=0;
+  const char *d;
+  if (!f) {
+    perror(name);
+    return 0;
+  }
+  while (fgets(line,sizeof(line),f)) {
+    lineno++;
+    if (strchr(line,'#'))
+      *strchr(line,'#')=0;
+    n=sscanf(line,"%31s %31s %31s %31s",time,cmd,a,b);
+    if (n<=0)
+      continue;
+    if (nevents==MAXEVENTS)
+      goto bad;
+    Event& e=events[nevents];
+    memset(&e,0,sizeof(e));
+    if (time[0]=='+')
+      s=prev+atof(time+1);
+    else if (sscanf(time,"%u:%u:%lf",&h,&m,&s)==3)
+      s+=h*3600.0+m*60.0;
+    else
+      goto bad;
+    if (s<prev || n<2)
+      goto bad;
+    prev=s;
+    e.when=(uint64_t)(s*SIM_SECOND);
+    if (!strcmp(cmd,"rtc") && n==4 &&
+        sscanf(a,"%u-%u-%u",&Y,&M,&D)==3 && sscanf(b,"%u:%u:%u",&hh,&mm,&ss)==3 &&
+        sscanf(line,"%*s %*s %*s %*s %u",&w)==1) {
+      e.type=EV_RTC;
+      e.arg[0]=Y;
+      e.arg[1]=M;
+      e.arg[2]=D;
+      e.arg[3]=hh;
+      e.arg[4]=mm;
+      e.arg[5]=ss;
+      e.arg[6]=w;
+    }
+    else if (!strcmp(cmd,"press") && n>=3) {
+      e.type=EV_PRESS;
+      if (!strcmp(a,"minus"))
+        e.arg[0]=SIM_MINUS;
+      else if (!strcmp(a,"plus"))
+        e.arg[0]=SIM_PLUS;
+      else if (!strcmp(a,"enter"))
+        e.arg[0]=SIM_ENTER;
+      else
+        goto bad;
+      e.value=n>3?atof(b):150;
+    }
+    else if (!strcmp(cmd,"sensor") && n>=3) {
+      e.type=EV_SENSOR;
+      e.value=strcmp(a,"auto")?atoi(a):-1;
+    }
+    else if (!strcmp(cmd,"battery") && n>=3) {
+      e.type=EV_BATTERY;
+      e.value=atof(a);
+      e.span=n>3?atof(b):0;
+    }
+    else if (!strcmp(cmd,"jam") && n>=3) {
+      e.type=EV_JAM;
+      e.value=atof(a);
+    }
+    else if (!strcmp(cmd,"empty") && n>=3) {
+      e.type=EV_EMPTY;
+      e.value=atoi(a);
+    }
+    else if (!strcmp(cmd,"feed") && n==4 && !e.when && nfeed<FEEDINGS &&
+        sscanf(a,"%u:%u",&hh,&mm)==2 && hh<24 && mm<60 && atoi(b)<=40) {
+      e.type=EV_FEED;
+      e.arg[0]=hh;
+      e.arg[1]=mm;
+      e.arg[2]=atoi(b);
+      e.arg[3]=ALLDAYS;
+      if (sscanf(line,"%*s %*s %*s %*s %31s",a)==1) {
+        e.arg[3]=0;
+        for (d=a;*d;d++) {
+          if (*d<'1' || *d>'7')
+            goto bad;
+          e.arg[3]|=1<<(*d-'1');
+        }
+      }
+      nfeed++;
+    }
+    else if (!strcmp(cmd,"erase") && n==2 && !e.when && !nfeed)
+      e.type=EV_ERASE;
+    else if (!strcmp(cmd,"end") && n==2)
+      e.type=EV_END;
+    else
+      goto bad;
+    if (e.type==EV_SENSOR || e.type==EV_JAM || e.type==EV_EMPTY) {
+      e.arg[0]=n>3?atoi(b):0;
+      if (e.arg[0]>HOPPERS || (n>3 && !e.arg[0]))
+        goto bad;
+    }
+    nevents++;
+  }
+  fclose(f);
+  if (!nevents || events[nevents-1].type!=EV_END) {
+    fprintf(stderr,"%s: scenario must finish with end\n",name);
+    return 0;
+  }
+  return 1;
+bad:
+  fprintf(stderr,"%s:%d: bad event\n",name,lineno);
+  fclose(f);
+  return 0;
+}
+
+// metrics, the exact ones describe behaviour and any change is
+// reported, the others are costs and only getting worse is
+struct Metric
+{
+  const char *name;
+  double value;
+  uint8_t exact;
+};
+
+#define MAXMETRICS 24
+
+static Metric metrics[MAXMETRICS];
+static uint8_t nmetrics;
+
+static void metric(const char *name,double value,uint8_t exact=0)
+{
+  metrics[nmetrics].name=name;
+  metrics[nmetrics].value=value;
+  metrics[nmetrics].exact=exact;
+  nmetrics++;
+}
+
+static void collect(void)
+{
+  probe();
+  mode_time[mode]+=sim_now()-mode_since;
+  mode_since=sim_now();
+  metric("awake_ms",ms(sim_stats.cpu[CPU_ACTIVE]+sim_stats.cpu[CPU_IDLE]+sim_stats.cpu[CPU_ADCNR]));
+  metric("active_ms",ms(sim_stats.cpu[CPU_ACTIVE]));
+  metric("full_ms",ms(mode_time[FULL]));
+  metric("low_ms",ms(mode_time[LOW]));
+  metric("powersave_ms",ms(mode_time[POWERSAVE]));
+  metric("latency_max_ms",ms(latency_max));
+  metric("latency_mean_ms",answered?ms(latency_sum)/answered:0.0);
+  metric("presses",presses,1);
+  metric("presses_answered",answered,1);
+  metric("wakes_wdt",sim_stats.wakes_wdt);
+  metric("wakes_pcint",sim_stats.wakes_pcint,1);
+  metric("resets",sim_stats.resets);
+  metric("interrupts",sim_stats.interrupts);
+  metric("rtc_transactions",sim_stats.rtc_transactions);
+  metric("eeprom_writes",sim_stats.eeprom_writes);
+  metric("calibration",ee_calibration,1);
+  metric("servo_pulses",sim_stats.servo_pulses);
+  metric("sensor_ticks",sim_stats.sensor_ticks,1);
+#if HOPPERS>1
+  metric("hopper1_ticks",sim_stats.hopper_ticks[0],1);
+  metric("hopper2_ticks",sim_stats.hopper_ticks[1],1);
+#endif
+  metric("fault",ee_fault.kind,1);
+  metric("tones",sim_stats.tones,1);
+  metric("held",held,1);
+  metric("charge_mas",sim_stats.charge);
+  metric("peak_ma",sim_stats.peak_ma);
+}
+
+// compare against a baseline written by an earlier run, returns the
+// number of regressions
+static int compare(const char *name,double tolerance)
+{
+  FILE *f=fopen(name,"r");
+  char line[MAXLINE],key[64];
+  double base,v;
+  uint8_t i,found;
+  int bad=0;
+  if (!f) {
+    perror(name);
+    return 1;
+  }
+  for (i=0;i<nmetrics;i++) {
+    found=0;
+    rewind(f);
+    while (fgets(line,sizeof(line),f))
+      if (sscanf(line,"%63s %lf",key,&base)==2 && !strcmp(key,metrics[i].name)) {
+        found=1;
+        break;
+      }
+    v=metrics[i].value;
+    if (!found) {
+      printf("%-20s missing from baseline\n",metrics[i].name);
+      bad++;
+    }
+    else if (metrics[i].exact ? v!=base : v>base*(1+tolerance)+0.001) {
+      printf("%-20s %12.3f was %12.3f  REGRESSION\n",metrics[i].name,v,base);
+      bad++;
+    }
+    else if (v<base*(1-tolerance)-0.001)
+      printf("%-20s %12.3f was %12.3f  improved\n",metrics[i].name,v,base);
+  }
+  fclose(f);
+  return bad;
+}
+
+int main(int argc,char *argv[])
+{
+  const char *baseline=0;
+  double tolerance=0.02;
+  uint8_t i;
+  int c;
+  while ((c=getopt(argc,argv,"b:t:"))!=-1) {
+    switch (c) {
+      case 'b':
+        baseline=optarg;
+        break;
+      case 't':
+        tolerance=atof(optarg)/100;
+        break;
+      default:
+        optind=argc;
+        break;
+    }
+  }
+  if (optind!=argc-1) {
+    fprintf(stderr,"usage: %s [-b baseline] [-t tolerance %%] scenario\n",argv[0]);
+    return 1;
+  }
+  if (!parse(argv[optind]))
+    return 1;
+  sim_rtc_set(17,1,1,0,0,0,7);
+  // events at time zero set up the device before it boots
+  while (next<nevents && !events[next].when)
+    run(events[next++]);
+  if (next<nevents)
+    sim_at(events[next].when,dispatch,0);
+  sim_probe(probe);
+  sim_run(firmware_main,events[nevents-1].when);
+  collect();
+  if (baseline) {
+    int bad=compare(baseline,tolerance);
+    printf("%s: %s\n",argv[optind],bad?"FAILED":"ok");
+    return bad?1:0;
+  }
+  printf("# %s\n",argv[optind]);
+  for (i=0;i<nmetrics;i++)
+    printf("%-20s %.3f\n",metrics[i].name,metrics[i].value);
+  return 0;
+}
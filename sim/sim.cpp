@@ -0,0 +1,1253 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <avr/io.h>
+#include "sim.hpp"
+
+#define ACCESS_CYCLES 4 // each register access, covers the code around it
+#define ISR_CYCLES 30   // interrupt entry, register save/restore and reti
+#define EEPROM_WRITE_CYCLES (SIM_MS*34/10)
+#define SERVO_FRAME (SIM_MS*20)
+
+SimPower sim_power = {
+  4.0,    // active
+  1.3,    // idle
+  0.9,    // adcnr
+  0.006,  // powerdown
+  4.0,    // segment
+  6.0,    // servo_idle
+  160.0,  // servo_run
+  250.0,  // servo_inrush
+  15.0,   // speaker
+  10.0,   // sensor
+  0.25,   // adc
+  0.02    // vref
+};
+
+SimMechanics sim_mech = {
+  6.0,    // pulses_per_tick
+  5000,   // nominal_mv
+  { 0.0 },// jam_rate
+  1.5,    // empty_speedup
+  { 0 },  // empty
+  0.3,    // esr
+  0.0,    // wdt_drift
+  1       // seed
+};
+
+SimStats sim_stats;
+
+extern "C" {
+  void sim_vect_PCINT0(void) __attribute__((weak));
+  void sim_vect_PCINT1(void) __attribute__((weak));
+  void sim_vect_PCINT2(void) __attribute__((weak));
+  void sim_vect_WDT(void) __attribute__((weak));
+  void sim_vect_TIMER2_COMPA(void) __attribute__((weak));
+  void sim_vect_TIMER2_COMPB(void) __attribute__((weak));
+  void sim_vect_TIMER2_OVF(void) __attribute__((weak));
+  void sim_vect_TIMER1_COMPA(void) __attribute__((weak));
+  void sim_vect_TIMER1_COMPB(void) __attribute__((weak));
+  void sim_vect_TIMER1_OVF(void) __attribute__((weak));
+  void sim_vect_TIMER0_COMPA(void) __attribute__((weak));
+  void sim_vect_TIMER0_COMPB(void) __attribute__((weak));
+  void sim_vect_TIMER0_OVF(void) __attribute__((weak));
+  void sim_vect_ADC(void) __attribute__((weak));
+  // runs the firmware static constructors again after a reset
+  void sim_firmware_reset(void) __attribute__((weak));
+}
+
+// interrupt vectors in priority order, with their flag and enable bits
+static const struct {
+  void (*handler)(void);
+  uint8_t flagreg,flagbit,enreg,enbit;
+  uint8_t wakes; // bitmask of CPU states that this interrupt wakes from
+} vectors[] = {
+  { sim_vect_PCINT0,       R_PCIFR, PCIF0, R_PCICR, PCIE0, 0x0f },
+  { sim_vect_PCINT1,       R_PCIFR, PCIF1, R_PCICR, PCIE1, 0x0f },
+  { sim_vect_PCINT2,       R_PCIFR, PCIF2, R_PCICR, PCIE2, 0x0f },
+  { sim_vect_WDT,          R_WDTCSR,WDIF,  R_WDTCSR,WDIE,  0x0f },
+  { sim_vect_TIMER2_COMPA, R_TIFR2, OCF2A, R_TIMSK2,OCIE2A,0x03 },
+  { sim_vect_TIMER2_COMPB, R_TIFR2, OCF2B, R_TIMSK2,OCIE2B,0x03 },
+  { sim_vect_TIMER2_OVF,   R_TIFR2, TOV2,  R_TIMSK2,TOIE2, 0x03 },
+  { sim_vect_TIMER1_COMPA, R_TIFR1, OCF1A, R_TIMSK1,OCIE1A,0x03 },
+  { sim_vect_TIMER1_COMPB, R_TIFR1, OCF1B, R_TIMSK1,OCIE1B,0x03 },
+  { sim_vect_TIMER1_OVF,   R_TIFR1, TOV1,  R_TIMSK1,TOIE1, 0x03 },
+  { sim_vect_TIMER0_COMPA, R_TIFR0, OCF0A, R_TIMSK0,OCIE0A,0x03 },
+  { sim_vect_TIMER0_COMPB, R_TIFR0, OCF0B, R_TIMSK0,OCIE0B,0x03 },
+  { sim_vect_TIMER0_OVF,   R_TIFR0, TOV0,  R_TIMSK0,TOIE0, 0x03 },
+  { sim_vect_ADC,          R_ADCSRA,ADIF,  R_ADCSRA,ADIE,  0x07 },
+};
+
+enum { JMP_START, JMP_END, JMP_RESET };
+
+static const uint16_t t01_prescale[8] = { 0,1,8,64,256,1024,0,0 };
+static const uint16_t t2_prescale[8] = { 0,1,8,32,64,128,256,1024 };
+static const uint8_t adc_prescale[8] = { 2,2,4,8,16,32,64,128 };
+
+// everything below is plain zero initialized data, the firmware global
+// constructors already touch the registers before sim_run() is called
+static uint16_t reg[R_COUNT];
+static uint64_t now,end,accounted;
+static jmp_buf jump;
+static uint8_t running,sreg_i,in_isr,cpu;
+static uint32_t dispatched;
+static uint64_t wdt_time,wdt_unlocked;
+static uint16_t t0_count;
+static uint64_t t0_time;
+static uint16_t t2_count;
+static uint64_t t2_time;
+static uint8_t t2_skip,oc2a,oc2b;
+static uint8_t adc_busy,adc_first,adc_latch;
+static uint64_t adc_done;
+static uint16_t adc_result;
+static uint8_t buttons[SIM_BUTTONS];
+static uint16_t battery_mv;
+static uint8_t pins_last[3],speaker;
+// dispenser wheel of each hopper, with its servo and movement sensor
+static struct {
+  uint8_t servo_pin;
+  uint64_t servo_rise,drive_until;
+  double drive_ma,speed,position;
+  uint8_t jammed;
+  double jam_back;
+  uint8_t sensor_level,sensor_was_powered;
+  uint8_t sensor_forced; // forced level+1, 0 when the wheel drives it
+} wheel[HOPPERS];
+static uint8_t display_image[3];
+static void (*probe)(void);
+static uint32_t rnd;
+// DS1302
+static uint8_t rtc_ce,rtc_clk,rtc_phase,rtc_bits,rtc_cmd,rtc_data,rtc_addr,rtc_io;
+static uint8_t rtc_latch[8];
+static uint8_t rtc_wp,rtc_halt,rtc_trickle,rtc_dow;
+static uint32_t rtc_seconds;
+static uint64_t rtc_time;
+// awake sessions
+static uint8_t session_class;
+static uint64_t session_start,session_active;
+static double session_charge;
+static uint32_t session_pulses;
+// loads and next event are evaluated again only after a state change
+static uint8_t dirty=1,loads;
+static double load_ma;
+static uint64_t due;
+// call back queue
+static struct {
+  uint64_t when;
+  void (*fn)(void *);
+  void *arg;
+} events[64];
+static uint8_t nevents;
+
+static void pins_update(void);
+static uint64_t next_event(void);
+
+enum { LOAD_DISPLAY=1, LOAD_SERVO=2, LOAD_SPEAKER=4, LOAD_SENSOR=8 };
+
+static uint8_t bit(uint8_t r,uint8_t b)
+{
+  return (reg[r]>>b)&1;
+}
+
+static uint8_t popcount(uint8_t v)
+{
+  uint8_t c=0;
+  while (v) {
+    c+=v&1;
+    v>>=1;
+  }
+  return c;
+}
+
+static uint32_t random32(void)
+{
+  rnd=rnd*1103515245+12345;
+  return rnd>>1;
+}
+
+static double random01(void)
+{
+  return (random32()&0xffffff)/(double)0x1000000;
+}
+
+static uint8_t clkio_running(void)
+{
+  return cpu==CPU_ACTIVE || cpu==CPU_IDLE;
+}
+
+//---------------------------------------------------------------------
+// power accounting
+
+// the last digit is on PB7 when PB3 drives the second servo
+#if HOPPERS>1
+#define CATHODES (_BV(PB5)|_BV(PB4)|_BV(PB7))
+#define LAST_DIGIT _BV(PB7)
+#else
+#define CATHODES (_BV(PB5)|_BV(PB4)|_BV(PB3))
+#define LAST_DIGIT _BV(PB3)
+#endif
+
+static uint8_t lit_segments(void)
+{
+  uint8_t cathodes=(~reg[R_PORTB])&reg[R_DDRB]&CATHODES;
+  uint8_t segments=(reg[R_PORTD]&reg[R_DDRD]&0xe6)|(reg[R_PORTB]&reg[R_DDRB]&0x05);
+  return popcount(cathodes)*popcount(segments);
+}
+
+static uint8_t servo_powered(void)
+{
+  return bit(R_PORTD,PD4) && bit(R_DDRD,PD4);
+}
+
+// with more than one hopper the sensors share the servo power
+static uint8_t sensor_powered(void)
+{
+#if HOPPERS>1
+  return servo_powered();
+#else
+  return bit(R_PORTB,PB7) && bit(R_DDRB,PB7);
+#endif
+}
+
+static double current(void)
+{
+  static const double *cpu_ma[CPU_STATES] = {
+    &sim_power.active,&sim_power.idle,&sim_power.adcnr,&sim_power.powerdown
+  };
+  double i=*cpu_ma[cpu];
+  uint8_t h;
+  i+=lit_segments()*sim_power.segment;
+  if (servo_powered()) {
+    for (h=0;h<HOPPERS;h++) {
+      i+=sim_power.servo_idle;
+      if (now<wheel[h].drive_until)
+        i+=wheel[h].drive_ma;
+    }
+  }
+  if (speaker)
+    i+=sim_power.speaker;
+  if (sensor_powered())
+    i+=sim_power.sensor;
+  if (bit(R_ADCSRA,ADEN))
+    i+=(cpu==CPU_POWERDOWN)?sim_power.vref:sim_power.adc;
+  return i;
+}
+
+static uint64_t evaluate_next(void);
+
+static void evaluate(void)
+{
+  load_ma=current();
+  if (load_ma>sim_stats.peak_ma)
+    sim_stats.peak_ma=load_ma;
+  loads=0;
+  if (lit_segments())
+    loads|=LOAD_DISPLAY;
+  if (servo_powered())
+    loads|=LOAD_SERVO;
+  if (speaker)
+    loads|=LOAD_SPEAKER;
+  if (sensor_powered())
+    loads|=LOAD_SENSOR;
+  due=evaluate_next();
+  dirty=0;
+}
+
+// integrate state up to current time
+static void account(void)
+{
+  uint64_t dt=now-accounted;
+  if (!dt)
+    return;
+  if (dirty)
+    evaluate();
+  accounted=now;
+  sim_stats.cpu[cpu]+=dt;
+  sim_stats.charge+=load_ma*dt/(double)SIM_SECOND;
+  if (loads&LOAD_DISPLAY)
+    sim_stats.display_on+=dt;
+  if (loads&LOAD_SERVO)
+    sim_stats.servo_on+=dt;
+  if (loads&LOAD_SPEAKER)
+    sim_stats.speaker_on+=dt;
+  if (loads&LOAD_SENSOR)
+    sim_stats.sensor_on+=dt;
+}
+
+static void session_begin(uint8_t cls)
+{
+  session_class=cls;
+  session_start=now;
+  session_active=sim_stats.cpu[CPU_ACTIVE];
+  session_charge=sim_stats.charge;
+  session_pulses=sim_stats.servo_pulses;
+}
+
+static void session_end(void)
+{
+  uint8_t cls=session_class;
+  if (cls!=SESSION_BOOT && sim_stats.servo_pulses!=session_pulses)
+    cls=SESSION_FEED;
+  SimSession& s=sim_stats.session[cls];
+  s.count++;
+  s.awake+=now-session_start;
+  s.active+=sim_stats.cpu[CPU_ACTIVE]-session_active;
+  s.charge+=sim_stats.charge-session_charge;
+}
+
+//---------------------------------------------------------------------
+// timers
+
+static uint16_t t2_top(void)
+{
+  uint8_t mode=(reg[R_TCCR2A]&3)|((reg[R_TCCR2B]&8)>>1);
+  if (mode==2 || mode==5 || mode==7)
+    return reg[R_OCR2A];
+  return 0xff;
+}
+
+static uint8_t t2_fastpwm(void)
+{
+  uint8_t mode=(reg[R_TCCR2A]&3)|((reg[R_TCCR2B]&8)>>1);
+  return mode==3 || mode==7;
+}
+
+static uint16_t t0_prescale(void)
+{
+  return clkio_running()?t01_prescale[reg[R_TCCR0B]&7]:0;
+}
+
+static uint16_t t2_prescaler(void)
+{
+  return clkio_running()?t2_prescale[reg[R_TCCR2B]&7]:0;
+}
+
+// bring timer counters up to date, called before anything that
+// changes how the timers count
+static void timers_sync(void)
+{
+  dirty=1;
+  uint16_t p=t0_prescale();
+  if (p) {
+    uint64_t ticks=(now-t0_time)/p;
+    t0_count+=ticks;
+    t0_time+=ticks*p;
+  }
+  else
+    t0_time=now;
+  p=t2_prescaler();
+  if (p) {
+    uint64_t ticks=(now-t2_time)/p;
+    if (!t2_count && !t2_top())
+      ticks=0; // counter stuck at zero
+    if (ticks) {
+      t2_count+=ticks;
+      t2_time+=ticks*p;
+      t2_skip=0;
+    }
+  }
+  else
+    t2_time=now;
+}
+
+static uint64_t t0_next(void)
+{
+  uint16_t p=t0_prescale();
+  if (!p)
+    return SIM_NEVER;
+  return t0_time+(uint64_t)(256-t0_count)*p;
+}
+
+// next timer2 event, compare match or wrap to bottom
+static uint64_t t2_next(void)
+{
+  uint16_t p=t2_prescaler(),top=t2_top(),lapend,v;
+  if (!p)
+    return SIM_NEVER;
+  lapend=(t2_count>top)?0xff:top;
+  if (lapend==0 && t2_count==0 && !reg[R_TIMSK2])
+    return SIM_NEVER; // counter stuck at zero, nothing can change
+  v=lapend+1;
+  if (reg[R_OCR2A]>=t2_count+t2_skip && reg[R_OCR2A]<v)
+    v=reg[R_OCR2A];
+  if (reg[R_OCR2B]>=t2_count+t2_skip && reg[R_OCR2B]<v)
+    v=reg[R_OCR2B];
+  return t2_time+(uint64_t)(v-t2_count)*p;
+}
+
+static void oc2_match(uint8_t& level,uint8_t com)
+{
+  if (t2_fastpwm()) {
+    if (com==2)
+      level=0;
+    else if (com==3)
+      level=1;
+  }
+  else {
+    if (com==1)
+      level^=1;
+    else if (com==2)
+      level=0;
+    else if (com==3)
+      level=1;
+  }
+}
+
+static void oc2_bottom(uint8_t& level,uint8_t com)
+{
+  if (t2_fastpwm()) {
+    if (com==2)
+      level=1;
+    else if (com==3)
+      level=0;
+  }
+}
+
+static void t2_event(void)
+{
+  uint16_t p=t2_prescaler(),top=t2_top();
+  uint16_t lapend=(t2_count>top)?0xff:top;
+  uint16_t v=t2_count+(now-t2_time)/p;
+  if (v!=t2_count)
+    t2_skip=0;
+  if (v>lapend) {
+    v=0;
+    if (t2_fastpwm() || lapend==0xff)
+      reg[R_TIFR2]|=_BV(TOV2);
+    oc2_bottom(oc2a,reg[R_TCCR2A]>>6);
+    oc2_bottom(oc2b,(reg[R_TCCR2A]>>4)&3);
+    t2_skip=0;
+  }
+  if (reg[R_OCR2A]==v && !t2_skip) {
+    reg[R_TIFR2]|=_BV(OCF2A);
+    oc2_match(oc2a,reg[R_TCCR2A]>>6);
+  }
+  if (reg[R_OCR2B]==v && !t2_skip) {
+    reg[R_TIFR2]|=_BV(OCF2B);
+    oc2_match(oc2b,(reg[R_TCCR2A]>>4)&3);
+  }
+  t2_count=v;
+  t2_time=now;
+  t2_skip=1;
+  pins_update();
+}
+
+//---------------------------------------------------------------------
+// watchdog
+
+static uint64_t wdt_period(void)
+{
+  uint8_t p=(reg[R_WDTCSR]&7)|((reg[R_WDTCSR]>>2)&8);
+  if (p>9)
+    p=9;
+  return (uint64_t)((2048UL<<p)*(F_CPU/128000.0)*(1.0+sim_mech.wdt_drift));
+}
+
+static uint64_t wdt_next(void)
+{
+  if (!(reg[R_WDTCSR]&(_BV(WDE)|_BV(WDIE))))
+    return SIM_NEVER;
+  return wdt_time+wdt_period();
+}
+
+static void reset(void)
+{
+  sim_stats.resets++;
+  longjmp(jump,JMP_RESET);
+}
+
+static void wdt_event(void)
+{
+  wdt_time=now;
+  if (reg[R_WDTCSR]&_BV(WDIE))
+    reg[R_WDTCSR]|=_BV(WDIF);
+  else
+    reset();
+}
+
+//---------------------------------------------------------------------
+// ADC
+
+static uint16_t battery_loaded(void)
+{
+  double mv=battery_mv-current()*sim_mech.esr;
+  return mv>0?(uint16_t)mv:0;
+}
+
+static void adc_start(void)
+{
+  adc_busy=1;
+  adc_done=now+(uint64_t)(adc_first?25:13)*adc_prescale[reg[R_ADCSRA]&7];
+}
+
+static void adc_event(void)
+{
+  double vref=1100.0,vin=0;
+  uint8_t mux=reg[R_ADMUX]&0x0f;
+  if ((reg[R_ADMUX]>>6)==1)
+    vref=battery_loaded();
+  if (mux==0)
+    vin=battery_loaded()*10.0/78.0; // 10K+68K divider
+  else if (mux==14)
+    vin=1100.0;
+  double v=vin*1024.0/vref+(random32()%3)-1.0;
+  adc_result=v<0?0:(v>1023?1023:(uint16_t)v);
+  adc_busy=0;
+  adc_first=0;
+  reg[R_ADCSRA]=(reg[R_ADCSRA]&~_BV(ADSC))|_BV(ADIF);
+}
+
+//---------------------------------------------------------------------
+// dispenser
+
+static void servo_pulse(uint8_t h,uint16_t us)
+{
+  double speed=0;
+  sim_stats.servo_pulses++;
+  if (us<1470 || us>1530) {
+    speed=(1500.0-us)/500.0;
+    if (speed>1.0)
+      speed=1.0;
+    if (speed<-1.0)
+      speed=-1.0;
+  }
+  dirty=1;
+  double inrush=speed-wheel[h].speed;
+  if (inrush<0)
+    inrush=-inrush;
+  double load=speed<0?-speed:speed;
+  wheel[h].drive_ma=load*sim_power.servo_run+inrush*sim_power.servo_inrush;
+  wheel[h].drive_until=now+SERVO_FRAME;
+  wheel[h].speed=speed;
+  double v=battery_loaded()/sim_mech.nominal_mv;
+  if (v>1.2)
+    v=1.2;
+  double move=speed*v/sim_mech.pulses_per_tick;
+  if (sim_mech.empty[h])
+    move*=sim_mech.empty_speedup;
+  if (move>0 && wheel[h].jammed)
+    return;
+  // backing off a third of a tick frees the wheel
+  if (move<0 && wheel[h].jammed) {
+    wheel[h].jam_back-=move;
+    if (wheel[h].jam_back>0.3)
+      wheel[h].jammed=0;
+  }
+  double& w=wheel[h].position;
+  double before=w;
+  w+=move;
+  if ((int64_t)(w+1000000.0)>(int64_t)(before+1000000.0) && random01()<sim_mech.jam_rate[h]) {
+    wheel[h].jammed=1;
+    wheel[h].jam_back=0;
+    w=(int64_t)(w+1000000.0)-1000000.0;
+  }
+}
+
+static uint8_t sensor_pin(uint8_t h)
+{
+  if (!sensor_powered())
+    return 0;
+  if (wheel[h].sensor_forced)
+    return wheel[h].sensor_forced-1;
+  double f=wheel[h].position-(int64_t)(wheel[h].position+1000000.0)+1000000.0;
+  return f<0.5;
+}
+
+//---------------------------------------------------------------------
+// DS1302 real time clock on PC3 (SCLK), PC4 (I/O) and PC5 (CE)
+
+static uint8_t tobcd(uint8_t v)
+{
+  return ((v/10)<<4)|(v%10);
+}
+
+static uint8_t tobin(uint8_t v)
+{
+  return (v>>4)*10+(v&15);
+}
+
+static uint32_t days_from_civil(int y,int m,int d)
+{
+  y-=m<=2;
+  int era=y/400;
+  int yoe=y-era*400;
+  int doy=(153*(m+(m>2?-3:9))+2)/5+d-1;
+  int doe=yoe*365+yoe/4-yoe/100+doy;
+  return era*146097+doe-730425; // days since 2000-01-01
+}
+
+static void civil_from_days(uint32_t days,int& y,int& m,int& d)
+{
+  int z=days+730425;
+  int era=z/146097;
+  int doe=z-era*146097;
+  int yoe=(doe-doe/1460+doe/36524-doe/146096)/365;
+  int doy=doe-(365*yoe+yoe/4-yoe/100);
+  int mp=(5*doy+2)/153;
+  d=doy-(153*mp+2)/5+1;
+  m=mp+(mp<10?3:-9);
+  y=yoe+era*400+(m<=2);
+}
+
+uint32_t sim_rtc_seconds(void)
+{
+  if (rtc_halt)
+    return rtc_seconds;
+  return rtc_seconds+(now-rtc_time)/SIM_SECOND;
+}
+
+static void rtc_rebase(uint32_t seconds)
+{
+  rtc_seconds=seconds;
+  rtc_time=now;
+}
+
+static uint8_t rtc_weekday(uint32_t seconds)
+{
+  return (seconds/86400+rtc_dow)%7+1;
+}
+
+static void rtc_snapshot(uint8_t *r)
+{
+  int y,m,d;
+  uint32_t t=sim_rtc_seconds();
+  civil_from_days(t/86400,y,m,d);
+  r[0]=tobcd(t%60)|(rtc_halt?0x80:0);
+  r[1]=tobcd((t/60)%60);
+  r[2]=tobcd((t/3600)%24);
+  r[3]=tobcd(d);
+  r[4]=tobcd(m);
+  r[5]=tobcd(rtc_weekday(t));
+  r[6]=tobcd(y%100);
+  r[7]=rtc_wp?0x80:0;
+}
+
+static void rtc_store(uint8_t adr,uint8_t v)
+{
+  uint8_t r[8];
+  int y,m,d,w;
+  if (adr==7) {
+    rtc_wp=v&0x80;
+    return;
+  }
+  if (rtc_wp)
+    return;
+  if (adr==8) {
+    rtc_trickle=v;
+    return;
+  }
+  if (adr>7)
+    return;
+  rtc_snapshot(r);
+  w=tobin(r[5]);
+  r[adr]=v;
+  if (adr==0)
+    rtc_halt=v&0x80;
+  y=2000+tobin(r[6]);
+  m=tobin(r[4]);
+  d=tobin(r[3]);
+  rtc_rebase(days_from_civil(y,m,d)*86400+tobin(r[2]&0x3f)*3600+tobin(r[1])*60+tobin(r[0]&0x7f));
+  if (adr==5)
+    w=tobin(v);
+  rtc_dow=(w-1+7-(rtc_seconds/86400)%7)%7;
+}
+
+static uint8_t rtc_fetch(uint8_t adr)
+{
+  if (adr<8)
+    return rtc_latch[adr];
+  if (adr==8)
+    return rtc_trickle;
+  return 0;
+}
+
+// called on every port C change
+static void rtc_update(void)
+{
+  uint8_t ce=bit(R_PORTC,PC5),clk=bit(R_PORTC,PC3),io=bit(R_PORTC,PC4);
+  if (!ce) {
+    rtc_ce=0;
+    rtc_clk=clk;
+    rtc_phase=0;
+    return;
+  }
+  if (!rtc_ce) { // start of a transaction
+    rtc_ce=1;
+    rtc_phase=1;
+    rtc_bits=0;
+    rtc_cmd=0;
+    sim_stats.rtc_transactions++;
+  }
+  if (clk && !rtc_clk) { // rising edge, clock data in
+    if (rtc_phase==1) {
+      rtc_cmd|=io<<rtc_bits;
+      if (++rtc_bits==8) {
+        rtc_addr=(rtc_cmd>>1)&0x1f;
+        if (rtc_cmd&0x40)
+          rtc_phase=0; // RAM is not used by the firmware
+        else
+          rtc_phase=(rtc_cmd&1)?3:2;
+        rtc_bits=0;
+        rtc_data=0;
+        rtc_snapshot(rtc_latch);
+      }
+    }
+    else if (rtc_phase==2) {
+      rtc_data|=io<<(rtc_bits%8);
+      if (++rtc_bits%8==0) {
+        uint8_t adr=rtc_addr,n=rtc_bits/8-1;
+        if (adr==31) // clock burst writes registers in sequence
+          adr=n;
+        else if (n)
+          adr=0xff;
+        rtc_store(adr,rtc_data);
+        rtc_data=0;
+      }
+    }
+  }
+  if (!clk && rtc_clk && rtc_phase==3) { // falling edge, clock data out
+    uint8_t adr=rtc_addr,n=rtc_bits/8;
+    if (adr==31)
+      adr=n;
+    else if (n)
+      adr=0xff;
+    rtc_io=(rtc_fetch(adr)>>(rtc_bits%8))&1;
+    rtc_bits++;
+  }
+  rtc_clk=clk;
+}
+
+void sim_rtc_set(uint8_t Y,uint8_t M,uint8_t D,uint8_t h,uint8_t m,uint8_t s,uint8_t w)
+{
+  rtc_halt=0;
+  rtc_rebase(days_from_civil(2000+Y,M,D)*86400+h*3600+m*60+s);
+  rtc_dow=(w-1+7-(rtc_seconds/86400)%7)%7;
+}
+
+//---------------------------------------------------------------------
+// pins
+
+static uint8_t pin_level(uint8_t port)
+{
+  uint8_t ddr=reg[R_DDRB+port*3],out=reg[R_PORTB+port*3];
+  uint8_t in=out; // unconnected inputs follow the pull-ups
+  switch (port) {
+    case 0:
+      in=(in&~_BV(PB6))|(wheel[0].sensor_level<<PB6);
+#if HOPPERS>1
+      in=(in&~_BV(PB1))|(wheel[1].sensor_level<<PB1);
+#endif
+      if ((reg[R_TCCR2A]>>6) && oc2a)
+        out|=_BV(PB3);
+      else if (reg[R_TCCR2A]>>6)
+        out&=~_BV(PB3);
+      break;
+    case 1:
+      if (buttons[SIM_MINUS])
+        in&=~_BV(PC1);
+      if (buttons[SIM_PLUS])
+        in&=~_BV(PC2);
+      in=(in&~_BV(PC4))|(rtc_phase==3?rtc_io<<PC4:0);
+      break;
+    case 2:
+      if (buttons[SIM_ENTER])
+        in&=~_BV(PD0);
+      if ((reg[R_TCCR2A]>>4)&3)
+        out=(out&~_BV(PD3))|(oc2b<<PD3);
+      break;
+  }
+  return (out&ddr)|(in&~ddr);
+}
+
+static void pins_update(void)
+{
+  uint8_t i,v;
+  account();
+  for (i=0;i<HOPPERS;i++) {
+    // servo control pulses, the second servo is on OC2A
+    v=i?(pin_level(0)>>PB3)&1:(pin_level(2)>>PD3)&1;
+    if (v && !wheel[i].servo_pin)
+      wheel[i].servo_rise=now;
+    if (!v && wheel[i].servo_pin && servo_powered())
+      servo_pulse(i,(now-wheel[i].servo_rise)*1000000/SIM_SECOND);
+    wheel[i].servo_pin=v;
+    // movement sensor
+    v=sensor_pin(i);
+    if (v && !wheel[i].sensor_level && wheel[i].sensor_was_powered) {
+      sim_stats.sensor_ticks++;
+      sim_stats.hopper_ticks[i]++;
+    }
+    wheel[i].sensor_was_powered=sensor_powered();
+    wheel[i].sensor_level=v;
+  }
+  // speaker on OC1A
+  v=(reg[R_TCCR1B]&7) && (reg[R_TCCR1A]>>6) && bit(R_DDRB,PB1) && clkio_running();
+  if (v!=speaker)
+    dirty=1;
+  if (v && !speaker)
+    sim_stats.tones++;
+  speaker=v;
+  // what the display shows, taken when exactly one digit is lit
+  v=(~reg[R_PORTB])&reg[R_DDRB]&CATHODES;
+  if (v==_BV(PB5) || v==_BV(PB4) || v==LAST_DIGIT)
+    display_image[v==_BV(PB5)?0:v==_BV(PB4)?1:2]=
+      (reg[R_PORTD]&reg[R_DDRD]&0xe6)|(reg[R_PORTB]&reg[R_DDRB]&0x05);
+  // pin change interrupts
+  for (i=0;i<3;i++) {
+    v=pin_level(i);
+    if ((v^pins_last[i])&reg[R_PCMSK0+i]) {
+      reg[R_PCIFR]|=_BV(i);
+      dirty=1;
+    }
+    pins_last[i]=v;
+  }
+}
+
+void sim_button(uint8_t button,uint8_t pressed)
+{
+  buttons[button]=pressed;
+  dirty=1;
+  pins_update();
+}
+
+void sim_sensor(uint8_t h,int8_t level)
+{
+  wheel[h].sensor_forced=level+1;
+  pins_update();
+}
+
+uint32_t sim_display(void)
+{
+  return display_image[0]|((uint32_t)display_image[1]<<8)|((uint32_t)display_image[2]<<16);
+}
+
+void sim_probe(void (*fn)(void))
+{
+  probe=fn;
+}
+
+void sim_battery(uint16_t mv)
+{
+  battery_mv=mv;
+  dirty=1;
+}
+
+uint16_t sim_battery(void)
+{
+  return battery_mv;
+}
+
+//---------------------------------------------------------------------
+// time keeping and interrupts
+
+uint64_t sim_now(void)
+{
+  return now;
+}
+
+void sim_at(uint64_t when,void (*fn)(void *),void *arg)
+{
+  uint8_t i;
+  if (nevents==sizeof(events)/sizeof(events[0])) {
+    fprintf(stderr,"sim: event queue full\n");
+    return;
+  }
+  for (i=nevents;i>0 && events[i-1].when>when;i--)
+    events[i]=events[i-1];
+  events[i].when=when;
+  events[i].fn=fn;
+  events[i].arg=arg;
+  nevents++;
+  dirty=1;
+}
+
+static uint64_t next_event(void)
+{
+  if (dirty)
+    evaluate();
+  return due;
+}
+
+static uint64_t evaluate_next(void)
+{
+  uint64_t t=SIM_NEVER,e;
+  if ((e=t0_next())<t)
+    t=e;
+  if ((e=t2_next())<t)
+    t=e;
+  if ((e=wdt_next())<t)
+    t=e;
+  if (adc_busy && adc_done<t)
+    t=adc_done;
+  for (uint8_t h=0;h<HOPPERS;h++)
+    if (wheel[h].drive_until>now && wheel[h].drive_until<t)
+      t=wheel[h].drive_until;
+  if (nevents && events[0].when<t)
+    t=events[0].when;
+  return t;
+}
+
+static void handle_events(void)
+{
+  uint8_t i;
+  dirty=1;
+  if (t0_next()<=now) {
+    reg[R_TIFR0]|=_BV(TOV0);
+    t0_count=0;
+    t0_time=now;
+  }
+  while (t2_next()<=now)
+    t2_event();
+  if (wdt_next()<=now)
+    wdt_event();
+  if (adc_busy && adc_done<=now)
+    adc_event();
+  while (nevents && events[0].when<=now) {
+    void (*fn)(void *)=events[0].fn;
+    void *arg=events[0].arg;
+    nevents--;
+    for (i=0;i<nevents;i++)
+      events[i]=events[i+1];
+    fn(arg);
+  }
+}
+
+static void step_to(uint64_t t)
+{
+  if (t<now) // an interrupt handler may have run past the target
+    return;
+  if (running && t>end) {
+    now=end;
+    account();
+    longjmp(jump,JMP_END);
+  }
+  now=t;
+  account();
+}
+
+static void advance(uint64_t cycles);
+
+static uint8_t pending(void)
+{
+  return (reg[R_PCIFR]&reg[R_PCICR]) ||
+    (reg[R_WDTCSR]&(_BV(WDIF)|_BV(WDIE)))==(_BV(WDIF)|_BV(WDIE)) ||
+    (reg[R_TIFR0]&reg[R_TIMSK0]) || (reg[R_TIFR1]&reg[R_TIMSK1]) ||
+    (reg[R_TIFR2]&reg[R_TIMSK2]) ||
+    (reg[R_ADCSRA]&(_BV(ADIF)|_BV(ADIE)))==(_BV(ADIF)|_BV(ADIE));
+}
+
+static void dispatch(void)
+{
+  uint8_t i;
+  if (!sreg_i || in_isr || !pending())
+    return;
+  for (i=0;i<sizeof(vectors)/sizeof(vectors[0]);i++) {
+    if (!(bit(vectors[i].flagreg,vectors[i].flagbit) && bit(vectors[i].enreg,vectors[i].enbit)))
+      continue;
+    if (!(vectors[i].wakes&_BV(cpu)))
+      continue;
+    if (cpu!=CPU_ACTIVE) {
+      if (cpu==CPU_POWERDOWN) {
+        if (vectors[i].handler==sim_vect_WDT) {
+          sim_stats.wakes_wdt++;
+          session_begin(SESSION_WAKE);
+        }
+        else {
+          sim_stats.wakes_pcint++;
+          session_begin(SESSION_MENU);
+        }
+      }
+      timers_sync();
+      cpu=CPU_ACTIVE;
+      pins_update();
+    }
+    // the hardware clears the flag when the vector is taken
+    reg[vectors[i].flagreg]&=~_BV(vectors[i].flagbit);
+    if (vectors[i].handler==sim_vect_WDT && (reg[R_WDTCSR]&_BV(WDE)))
+      reg[R_WDTCSR]&=~_BV(WDIE);
+    sim_stats.interrupts++;
+    dispatched++;
+    if (!vectors[i].handler) // bad interrupt jumps to reset vector
+      reset();
+    in_isr=1;
+    sreg_i=0;
+    advance(ISR_CYCLES/2);
+    vectors[i].handler();
+    advance(ISR_CYCLES/2);
+    sreg_i=1;
+    in_isr=0;
+    dirty=1;
+    i=(uint8_t)-1; // restart from the highest priority
+  }
+}
+
+static void advance(uint64_t cycles)
+{
+  uint64_t target=now+cycles,t;
+  while ((t=next_event())<=target) {
+    step_to(t);
+    handle_events();
+    dispatch();
+  }
+  step_to(target);
+  dispatch();
+}
+
+//---------------------------------------------------------------------
+// the register interface used by the firmware
+
+uint16_t sim_read(uint8_t r)
+{
+  uint16_t v;
+  advance(ACCESS_CYCLES);
+  switch (r) {
+    case R_PINB:
+      return pin_level(0);
+    case R_PINC:
+      return pin_level(1);
+    case R_PIND:
+      return pin_level(2);
+    case R_TCNT0:
+      timers_sync();
+      return t0_count;
+    case R_TCNT2:
+      timers_sync();
+      return t2_count;
+    case R_ADCL:
+      adc_latch=adc_result>>8;
+      return adc_result&0xff;
+    case R_ADCH:
+      return adc_latch;
+    case R_ADCSRA:
+      v=reg[r]&~_BV(ADSC);
+      if (adc_busy)
+        v|=_BV(ADSC);
+      return v;
+    default:
+      return reg[r];
+  }
+}
+
+void sim_write(uint8_t r,uint16_t v)
+{
+  uint16_t old;
+  advance(ACCESS_CYCLES);
+  old=reg[r];
+  switch (r) {
+    case R_PINB:
+    case R_PINC:
+    case R_PIND:
+      reg[r+2]^=v; // writing PINx toggles PORTx
+      break;
+    case R_TIFR0:
+    case R_TIFR1:
+    case R_TIFR2:
+    case R_PCIFR:
+      reg[r]&=~v; // interrupt flags are cleared by writing one
+      break;
+    case R_TCCR0B:
+    case R_TCCR2A:
+    case R_TCCR2B:
+    case R_OCR2A:
+    case R_OCR2B:
+      timers_sync();
+      reg[r]=v;
+      break;
+    case R_TCNT0:
+      timers_sync();
+      t0_count=v;
+      t0_time=now;
+      break;
+    case R_TCNT2:
+      timers_sync();
+      t2_count=v;
+      t2_time=now;
+      t2_skip=1; // compare match is blocked for one timer clock
+      break;
+    case R_WDTCSR:
+      if (v&_BV(WDIF))
+        reg[r]&=~_BV(WDIF);
+      if (now<=wdt_unlocked) { // timed sequence, everything can change
+        reg[r]=(reg[r]&_BV(WDIF))|(v&~(_BV(WDIF)|_BV(WDCE)));
+        wdt_unlocked=0;
+      }
+      else {
+        reg[r]=(reg[r]&~_BV(WDIE))|(v&_BV(WDIE))|(v&_BV(WDE));
+        if ((v&(_BV(WDCE)|_BV(WDE)))==(_BV(WDCE)|_BV(WDE)))
+          wdt_unlocked=now+2*ACCESS_CYCLES;
+      }
+      if (reg[R_MCUSR]&_BV(WDRF))
+        reg[r]|=_BV(WDE);
+      break;
+    case R_MCUSR:
+      reg[r]&=v;
+      break;
+    case R_ADCSRA:
+      if (v&_BV(ADIF))
+        reg[r]&=~_BV(ADIF);
+      reg[r]=(reg[r]&_BV(ADIF))|(v&~(_BV(ADIF)|_BV(ADSC)));
+      if (!(v&_BV(ADEN))) {
+        adc_busy=0;
+        adc_first=1;
+      }
+      else if ((v&_BV(ADSC)) && !adc_busy)
+        adc_start();
+      break;
+    default:
+      reg[r]=v;
+      break;
+  }
+  // the clock lines do not change loads or events, which keeps the
+  // bit-banged DS1302 traffic cheap to simulate
+  if ((reg[r]!=old && r!=R_PORTC && r!=R_DDRC) || r==R_PINB || r==R_PIND ||
+      (r>=R_TCCR0A && r<=R_ASSR) || r==R_ADCSRA)
+    dirty=1;
+  if (r<=R_PORTD || r==R_TCCR1A || r==R_TCCR1B || r==R_TCCR2A)
+    pins_update();
+  if (r==R_PORTC || r==R_DDRC)
+    rtc_update();
+  if (probe)
+    probe();
+}
+
+void sim_sei(void)
+{
+  advance(1);
+  sreg_i=1;
+  dispatch();
+}
+
+void sim_cli(void)
+{
+  advance(1);
+  sreg_i=0;
+}
+
+void sim_busy(uint64_t cycles)
+{
+  advance(cycles);
+}
+
+void sim_wdt_reset(void)
+{
+  advance(1);
+  wdt_time=now; // only moves the next event later, no need to evaluate
+}
+
+void sim_eeprom_read(void *dst,const void *src,size_t n)
+{
+  advance(n*ACCESS_CYCLES);
+  memcpy(dst,src,n);
+}
+
+void sim_eeprom_write(void *dst,const void *src,size_t n)
+{
+  while (n--) {
+    advance(EEPROM_WRITE_CYCLES);
+    *(uint8_t*)dst=*(const uint8_t*)src;
+    dst=(uint8_t*)dst+1;
+    src=(const uint8_t*)src+1;
+    sim_stats.eeprom_writes++;
+  }
+}
+
+void sim_sleep(void)
+{
+  uint32_t d=dispatched;
+  uint8_t mode;
+  uint64_t t;
+  if (!bit(R_SMCR,SE)) {
+    advance(1);
+    return;
+  }
+  mode=(reg[R_SMCR]>>1)&7;
+  account();
+  timers_sync();
+  if (mode==0)
+    cpu=CPU_IDLE;
+  else if (mode==1)
+    cpu=CPU_ADCNR;
+  else
+    cpu=CPU_POWERDOWN;
+  if (cpu==CPU_POWERDOWN) {
+    session_end();
+    adc_busy=0;
+  }
+  if (cpu==CPU_ADCNR && bit(R_ADCSRA,ADEN) && !adc_busy)
+    adc_start();
+  pins_update();
+  dispatch();
+  while (dispatched==d) {
+    t=next_event();
+    if (t==SIM_NEVER)
+      t=end+1;
+    step_to(t);
+    handle_events();
+    dispatch();
+  }
+}
+
+void sim_run(int (*entry)(void),uint64_t until)
+{
+  end=until;
+  rnd=sim_mech.seed;
+  if (!battery_mv)
+    battery_mv=5000;
+  reg[R_MCUSR]|=_BV(PORF);
+  adc_first=1;
+  session_begin(SESSION_BOOT);
+  running=1;
+  switch (setjmp(jump)) {
+    case JMP_START:
+      break;
+    case JMP_END:
+      return;
+    case JMP_RESET:
+      // registers go back to their reset values, the watchdog stays
+      // enabled with shortest timeout until the firmware changes it
+      memset(reg,0,sizeof(reg));
+      reg[R_MCUSR]=_BV(WDRF);
+      reg[R_WDTCSR]=_BV(WDE);
+      wdt_time=now;
+      sreg_i=0;
+      in_isr=0;
+      cpu=CPU_ACTIVE;
+      adc_busy=0;
+      adc_first=1;
+      t0_count=0;
+      t2_count=0;
+      timers_sync();
+      pins_update();
+      if (sim_firmware_reset)
+        sim_firmware_reset();
+      session_begin(SESSION_BOOT);
+      break;
+  }
+  entry();
+  // returning from main ends in a cli/sleep loop in avr-libc
+  sreg_i=0;
+  step_to(end+1);
+}
@@ -0,0 +1,142 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __sim_hpp__
+#define __sim_hpp__
+
+// virtual ATmega168 running the feeder firmware on a development host
+//
+// the device model keeps time in CPU clock cycles. code between two
+// register accesses is free, every access is charged a few cycles, and
+// _delay_ms() and EEPROM writes are charged their full length. sleeping
+// skips straight to the next event that can wake the CPU. this is not
+// cycle accurate, but it is exact about when the CPU is awake, what it
+// talks to and which loads are switched on, which is what decides the
+// battery life
+
+#include <stdint.h>
+
+// dispenser wheels, each with a servo and a movement sensor. must
+// match the firmware build, see servo.hpp
+#ifndef HOPPERS
+#define HOPPERS 1
+#endif
+
+#define SIM_SECOND ((uint64_t)F_CPU)
+#define SIM_MS (SIM_SECOND/1000)
+#define SIM_NEVER (~(uint64_t)0)
+
+// supply current figures in mA, used to integrate the charge drawn
+struct SimPower
+{
+  double active;       // CPU running at 8MHz
+  double idle;         // SLEEP_MODE_IDLE
+  double adcnr;        // SLEEP_MODE_ADC
+  double powerdown;    // SLEEP_MODE_PWR_DOWN with watchdog running
+  double segment;      // one lit display segment
+  double servo_idle;   // servo powered but not driven
+  double servo_run;    // servo running at full speed
+  double servo_inrush; // extra for one frame on full speed change
+  double speaker;
+  double sensor;       // movement sensor LED
+  double adc;          // ADC enabled and clocked
+  double vref;         // ADC left enabled in power down, bandgap reference
+};
+
+// dispenser mechanics and battery
+struct SimMechanics
+{
+  double pulses_per_tick; // servo pulses per sensor tick at full speed
+  double nominal_mv;      // supply voltage at which full speed is reached
+  double jam_rate[HOPPERS]; // chance that a wheel jams on a sensor tick
+  double empty_speedup;   // an empty hopper lets the wheel spin faster
+  uint8_t empty[HOPPERS]; // hopper is empty
+  double esr;             // battery internal resistance in ohms
+  double wdt_drift;       // watchdog oscillator error, 0.01 is 1% slow
+  uint32_t seed;          // random generator seed for jams
+};
+
+enum { SESSION_BOOT, SESSION_WAKE, SESSION_MENU, SESSION_FEED, SESSION_CLASSES };
+enum { CPU_ACTIVE, CPU_IDLE, CPU_ADCNR, CPU_POWERDOWN, CPU_STATES };
+enum { SIM_MINUS, SIM_PLUS, SIM_ENTER, SIM_BUTTONS };
+
+// one session lasts from waking up from power down until the
+// firmware goes back to power down sleep
+struct SimSession
+{
+  uint32_t count;
+  uint64_t awake;  // cycles from wakeup to power down
+  uint64_t active; // cycles the CPU was running
+  double charge;   // mAs
+};
+
+struct SimStats
+{
+  uint64_t cpu[CPU_STATES]; // cycles spent in each CPU state
+  double charge;            // mAs drawn from the battery
+  double peak_ma;           // highest current drawn
+  uint64_t display_on;      // cycles with at least one segment lit
+  uint64_t servo_on;        // cycles with servo power on
+  uint64_t speaker_on;
+  uint64_t sensor_on;
+  uint32_t wakes_wdt;       // wakeups from power down by watchdog
+  uint32_t wakes_pcint;     // and by pin change
+  uint32_t resets;          // watchdog and bad interrupt resets
+  uint32_t interrupts;
+  uint32_t servo_pulses;
+  uint32_t sensor_ticks;
+  uint32_t hopper_ticks[HOPPERS]; // sensor_ticks of each hopper
+  uint32_t rtc_transactions;
+  uint32_t eeprom_writes;
+  uint32_t tones;
+  SimSession session[SESSION_CLASSES];
+};
+
+extern SimPower sim_power;
+extern SimMechanics sim_mech;
+extern SimStats sim_stats;
+
+uint64_t sim_now(void);
+// run the firmware entry point until virtual time reaches the end,
+// a watchdog reset restarts it after calling sim_firmware_reset()
+void sim_run(int (*entry)(void),uint64_t end);
+// schedule a call back from the simulation at given virtual time
+void sim_at(uint64_t when,void (*fn)(void *),void *arg);
+
+void sim_button(uint8_t button,uint8_t pressed);
+// force the output of the movement sensor of hopper h to given level,
+// -1 lets the dispenser wheel drive it again
+void sim_sensor(uint8_t h,int8_t level);
+// segment pins last seen lit on each digit, leftmost digit in bits 0..7
+uint32_t sim_display(void);
+// call back after every register write, lets a tool follow the
+// firmware state as it changes
+void sim_probe(void (*fn)(void));
+void sim_battery(uint16_t mv);
+uint16_t sim_battery(void);
+// set the real time clock, w is day of week 1..7
+void sim_rtc_set(uint8_t Y,uint8_t M,uint8_t D,uint8_t h,uint8_t m,uint8_t s,uint8_t w);
+// seconds since 2000-01-01 00:00:00 according to the real time clock
+uint32_t sim_rtc_seconds(void);
+
+#endif
@@ -0,0 +1,145 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "sim.hpp"
+#include "firmware.hpp"
+
+// runs the firmware for given number of days and reports where the
+// time and charge went
+//
+// usage: catfeeder_sim [-d days] [-v battery mV] [-p HH:MM]... [-j jamrate]
+//                      [-e] [-s seed]
+//
+// -p presses the ENTER button at given time every day, opening the menu
+// -e runs with an empty hopper
+
+#define MAXPRESSES 8
+
+static uint32_t presses[MAXPRESSES];
+static uint8_t npresses;
+
+static void release(void *)
+{
+  sim_button(SIM_ENTER,0);
+}
+
+static void press(void *arg)
+{
+  uint32_t *t=(uint32_t*)arg;
+  sim_button(SIM_ENTER,1);
+  sim_at(sim_now()+200*SIM_MS,release,0);
+  sim_at(sim_now()+86400*SIM_SECOND,press,t);
+}
+
+static double ms(uint64_t cycles)
+{
+  return cycles*1000.0/SIM_SECOND;
+}
+
+static void report(double days)
+{
+  static const char *names[SESSION_CLASSES] = { "boot","wake","menu","feed" };
+  static const char *states[CPU_STATES] = { "active","idle","adc","powerdown" };
+  uint8_t i;
+  uint64_t total=0;
+  printf("simulated           %.3f days\n",days);
+  printf("watchdog wakes      %u\n",sim_stats.wakes_wdt);
+  printf("pin change wakes    %u\n",sim_stats.wakes_pcint);
+  printf("resets              %u\n",sim_stats.resets);
+  printf("\nsession  count    awake ms/each  active ms/each  charge mAs/each  charge mAh\n");
+  for (i=0;i<SESSION_CLASSES;i++) {
+    const SimSession& s=sim_stats.session[i];
+    if (!s.count)
+      continue;
+    printf("%-8s %-8u %14.3f %15.3f %16.4f %11.3f\n",names[i],s.count,
+      ms(s.awake)/s.count,ms(s.active)/s.count,s.charge/s.count,s.charge/3600.0);
+  }
+  for (i=0;i<CPU_STATES;i++)
+    total+=sim_stats.cpu[i];
+  printf("\n");
+  for (i=0;i<CPU_STATES;i++)
+    printf("cpu %-15s %12.3f s %8.4f %%\n",states[i],ms(sim_stats.cpu[i])/1000.0,
+      total?sim_stats.cpu[i]*100.0/total:0.0);
+  printf("display on          %12.3f s\n",ms(sim_stats.display_on)/1000.0);
+  printf("servo on            %12.3f s\n",ms(sim_stats.servo_on)/1000.0);
+  printf("speaker on          %12.3f s\n",ms(sim_stats.speaker_on)/1000.0);
+  printf("sensor on           %12.3f s\n",ms(sim_stats.sensor_on)/1000.0);
+  printf("\ninterrupts          %u\n",sim_stats.interrupts);
+  printf("rtc transactions    %u\n",sim_stats.rtc_transactions);
+  printf("eeprom writes       %u\n",sim_stats.eeprom_writes);
+  printf("servo pulses        %u\n",sim_stats.servo_pulses);
+  printf("sensor ticks        %u\n",sim_stats.sensor_ticks);
+  printf("tones               %u\n",sim_stats.tones);
+  printf("\ncharge              %.3f mAh\n",sim_stats.charge/3600.0);
+  printf("peak current        %.1f mA\n",sim_stats.peak_ma);
+  printf("average current     %.1f uA\n",days>0?sim_stats.charge*1000.0/(days*86400.0):0.0);
+  printf("charge per day      %.3f mAh\n",days>0?sim_stats.charge/3600.0/days:0.0);
+}
+
+int main(int argc,char *argv[])
+{
+  double days=1.0;
+  int c,h,m;
+  uint8_t i;
+  while ((c=getopt(argc,argv,"d:v:p:j:es:"))!=-1) {
+    switch (c) {
+      case 'd':
+        days=atof(optarg);
+        break;
+      case 'v':
+        sim_battery(atoi(optarg));
+        break;
+      case 'p':
+        if (sscanf(optarg,"%d:%d",&h,&m)!=2 || npresses==MAXPRESSES) {
+          fprintf(stderr,"bad press time %s\n",optarg);
+          return 1;
+        }
+        presses[npresses++]=h*3600+m*60;
+        break;
+      case 'j':
+        for (i=0;i<HOPPERS;i++)
+          sim_mech.jam_rate[i]=atof(optarg);
+        break;
+      case 'e':
+        for (i=0;i<HOPPERS;i++)
+          sim_mech.empty[i]=1;
+        break;
+      case 's':
+        sim_mech.seed=atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,"usage: %s [-d days] [-v battery mV] [-p HH:MM]... [-j jamrate] [-e] [-s seed]\n",argv[0]);
+        return 1;
+    }
+  }
+  // simulation starts on sunday 2017-01-01 at midnight
+  sim_rtc_set(17,1,1,0,0,0,7);
+  for (i=0;i<npresses;i++)
+    sim_at(presses[i]*SIM_SECOND,press,&presses[i]);
+  sim_run(firmware_main,(uint64_t)(days*86400.0*SIM_SECOND));
+  report(days);
+  return 0;
+}
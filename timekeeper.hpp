@@ -0,0 +1,179 @@
+/*
+MIT License
+
+Copyright (c) 2017 Madis Kaal
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __timekeeper_hpp__
+#define __timekeeper_hpp__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// length of one timer0 tick and of the nominal 2 second watchdog period in
+// microseconds, these must match the setup in main()
+#ifndef TIMEKEEPER_TICK_US
+#define TIMEKEEPER_TICK_US 2560UL
+#endif
+#ifndef TIMEKEEPER_SLEEP_US
+#define TIMEKEEPER_SLEEP_US 2048000UL
+#endif
+// longest time between resyncs with the real time clock, in seconds
+#ifndef TIMEKEEPER_RESYNC
+#define TIMEKEEPER_RESYNC 600
+#endif
+
+#define SECONDS_PER_DAY (24L*60L*60L)
+
+// time of day kept in RAM, so that the real time clock only needs
+// to be read every few minutes. the time is advanced by timer ticks
+// while awake and by watchdog periods while powered down. the
+// watchdog oscillator drifts with voltage and temperature, so its
+// period is measured against the real time clock on each resync
+class TimeKeeper
+{
+  volatile int32_t seconds;  // seconds since midnight
+  volatile uint32_t usec;    // fraction of the current second
+  volatile uint32_t awake;   // timer tick time since last sync, in us
+  volatile uint16_t sleeps;  // watchdog periods since last sync
+  volatile uint32_t period;  // measured watchdog period in us
+  int32_t synced;            // clock reading at last sync
+  uint16_t interval;         // seconds between resyncs
+  uint8_t weight;            // measurements averaged into period, log2
+
+  void advance(uint32_t us)
+  {
+    usec+=us;
+    while (usec>=1000000UL) {
+      usec-=1000000UL;
+      if (++seconds>=SECONDS_PER_DAY)
+        seconds=0;
+    }
+  }
+
+public:
+  TimeKeeper()
+  {
+    seconds=0;
+    usec=0;
+    awake=0;
+    sleeps=0;
+    period=TIMEKEEPER_SLEEP_US;
+    synced=0;
+    interval=60; // resync often until the watchdog period is known
+    weight=0;
+  }
+
+  // called from timer interrupt
+  void Tick(void)
+  {
+    awake+=TIMEKEEPER_TICK_US;
+    advance(TIMEKEEPER_TICK_US);
+  }
+
+  // called from watchdog interrupt after n full periods in power down
+  void Sleep(uint8_t n)
+  {
+    if (sleeps<=0xffff-n)
+      sleeps+=n;
+    while (n--)
+      advance(period);
+  }
+
+  // returns number of current second within current day
+  int32_t Now(void)
+  {
+    int32_t t;
+    cli();
+    t=seconds;
+    sei();
+    return t;
+  }
+
+  uint32_t SecondsPassed(int32_t fromtime)
+  {
+    int32_t t=Now();
+    if (t>=fromtime)
+      return t-fromtime;
+    return t+(SECONDS_PER_DAY-fromtime);
+  }
+
+  // time spent awake since the last sync, in microseconds
+  uint32_t Awake(void)
+  {
+    uint32_t t;
+    cli();
+    t=awake;
+    sei();
+    return t;
+  }
+
+  // true when the time should be taken from the real time clock again
+  bool Due(void)
+  {
+    return SecondsPassed(synced)>=interval;
+  }
+
+  // take the time from the real time clock reading rtc. with measure
+  // set, the time since the previous sync corrects the watchdog period.
+  // this must not be done when a wakeup has cut a period short
+  void Sync(int32_t rtc,bool measure=true)
+  {
+    int32_t d;
+    uint32_t r,p;
+    cli();
+    d=seconds-rtc;
+    if (d>SECONDS_PER_DAY/2)
+      d-=SECONDS_PER_DAY;
+    if (d<-SECONDS_PER_DAY/2)
+      d+=SECONDS_PER_DAY;
+    // the clock only has whole seconds, make the smallest correction
+    // that agrees with it
+    if (d || !measure) {
+      seconds=rtc;
+      usec=(d>0 && measure)?999999UL:0;
+    }
+    if (measure && sleeps>=16) {
+      d=rtc-synced;
+      if (d<0)
+        d+=SECONDS_PER_DAY;
+      r=d*1000000UL;
+      if (d<4000 && r>awake) {
+        p=(r-awake)/sleeps;
+        // the first measurement replaces the nominal period, later
+        // ones are averaged in as they come from longer intervals
+        if (p>TIMEKEEPER_SLEEP_US*3/4 && p<TIMEKEEPER_SLEEP_US*5/4) {
+          period+=((int32_t)p-(int32_t)period)/(1<<weight);
+          if (weight<2)
+            weight++;
+        }
+      }
+    }
+    awake=0;
+    sleeps=0;
+    synced=rtc;
+    sei();
+    if (measure && interval<TIMEKEEPER_RESYNC)
+      interval=interval*2>TIMEKEEPER_RESYNC?TIMEKEEPER_RESYNC:interval*2;
+  }
+
+};
+
+#endif